@@ -0,0 +1,84 @@
+// ai streaming against the local mock server, from request to buffer
+
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <string>
+#include <thread>
+
+#include "ai.hpp"
+#include "editor.hpp"
+#include "mock.hpp"
+
+namespace {
+
+using ms = std::chrono::duration<double, std::milli>;
+
+// streams one completion into a fresh buffer the way the extension does,
+// batched once a frame and appended at the end, and times it there
+void run(const char *what, MockServer::script plan) {
+    MockServer server(plan);
+    ai::config settings;
+    settings.url = server.url();
+
+    Editor editor;
+    int flushes = 0;
+    ai::clock::time_point start;
+    std::optional<ai::clock::time_point> first;
+    ai::Batcher out([&](std::string text) {
+        auto hold = editor.lock();
+        const int last = std::max(0, editor.numlines() - 1);
+        const int end = editor.numlines() == 0
+                            ? 0
+                            : static_cast<int>(editor.chars_at(last).size());
+        editor.insert_text(last, end, text);
+        if (!first)
+            first = ai::clock::now();
+        flushes++;
+    });
+
+    start = ai::clock::now();
+    const ai::stats result = ai::complete(
+        settings, "bench", [&](std::string_view text) { out.add(text); }, {},
+        [&] { out.tick(); });
+    out.finish();
+    const auto done = ai::clock::now();
+
+    if (!result.error.empty()) {
+        std::printf("%-10s failed: %s\n", what, result.error.c_str());
+        return;
+    }
+    const double seconds =
+        std::chrono::duration<double>(done - first.value_or(done)).count();
+    std::printf("%-10s %5zu tokens  first token %7.2f ms  first in buffer "
+                "%7.2f ms  %9.0f tok/s into buffer  %4d edits\n",
+                what, result.tokens, ms(result.first).count(),
+                ms(first.value_or(done) - start).count(),
+                seconds > 0 ? static_cast<double>(result.tokens) / seconds : 0,
+                flushes);
+}
+
+} // namespace
+
+int main(int argc, char *argv[]) {
+    // `ai_bench serve [port]` keeps a mock endpoint up for trying the editor
+    // against, e.g. AI_URL=http://127.0.0.1:8080/v1/chat/completions
+    if (argc >= 2 && std::string(argv[1]) == "serve") {
+        MockServer::script plan;
+        plan.tokens = 400;
+        plan.first = std::chrono::milliseconds{150};
+        plan.gap = std::chrono::milliseconds{5};
+        MockServer server(plan, argc >= 3 ? std::atoi(argv[2]) : 8080);
+        std::printf("serving %s\n", server.url().c_str());
+        while (true)
+            std::this_thread::sleep_for(std::chrono::hours{1});
+    }
+
+    curl_global_init(CURL_GLOBAL_DEFAULT);
+    run("burst", {20000, "lorem ", {}, {}});
+    run("paced", {500, "lorem ", std::chrono::milliseconds{50},
+                  std::chrono::microseconds{500}});
+    run("lines", {5000, "ipsum\n", {}, {}});
+    curl_global_cleanup();
+    return 0;
+}
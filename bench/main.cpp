@@ -0,0 +1,292 @@
+// editor and ui hot paths, as json for tracking across versions
+//
+//   bench [--max-bytes N] [--only NAME] > results.json
+
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <filesystem>
+#include <fstream>
+#include <functional>
+#include <memory>
+#include <optional>
+#include <random>
+#include <string>
+#include <vector>
+
+#include <nlohmann/json.hpp>
+
+#include "tui.hpp"
+
+namespace {
+
+using clock = std::chrono::steady_clock;
+
+struct options {
+    std::uintmax_t maxbytes = 1ull << 30;
+    std::string only;
+};
+
+nlohmann::ordered_json results = nlohmann::ordered_json::array();
+options settings;
+
+bool wanted(const std::string &name) {
+    return settings.only.empty() ||
+           name.find(settings.only) != std::string::npos;
+}
+
+// best of a few rounds, each running `work` until it has taken a while.
+// `work` returns how many operations it did, `bytes` how many bytes one
+// operation covers, for a throughput figure next to the time.
+void measure(const std::string &name, const std::function<std::size_t()> &work,
+             double bytes = 0, int rounds = 5,
+             std::chrono::milliseconds least = std::chrono::milliseconds{100}) {
+    if (!wanted(name))
+        return;
+    double best = 0;
+    std::size_t total = 0;
+    for (int round = 0; round < rounds; round++) {
+        std::size_t ops = 0;
+        const auto start = clock::now();
+        auto took = clock::duration{};
+        do {
+            ops += work();
+            took = clock::now() - start;
+        } while (took < least);
+        const double ns =
+            std::chrono::duration<double, std::nano>(took).count() /
+            static_cast<double>(ops);
+        if (round == 0 || ns < best)
+            best = ns;
+        total += ops;
+    }
+
+    nlohmann::ordered_json entry = {
+        {"name", name}, {"ns_per_op", best}, {"ops", total}};
+    if (bytes > 0)
+        entry["mb_per_s"] = bytes / best * 1e3;
+    results.push_back(entry);
+    std::fprintf(stderr, "%-36s %14.1f ns/op\n", name.c_str(), best);
+}
+
+// a file of log-ish lines, made once and reused by every case
+std::string sample(std::uintmax_t bytes) {
+    const fs::path path = fs::temp_directory_path() /
+                          ("bench-" + std::to_string(bytes) + ".txt");
+    if (fs::exists(path) && fs::file_size(path) == bytes)
+        return path.string();
+
+    const std::string entry =
+        "2026-01-01 00:00:00\tINFO\tworker 12 finished job 4312 in 18ms\n";
+    std::string block;
+    while (block.size() < (4 << 20))
+        block += entry;
+    std::ofstream out(path, std::ios::binary | std::ios::trunc);
+    for (std::uintmax_t left = bytes; left > 0;) {
+        const std::size_t n = static_cast<std::size_t>(
+            std::min<std::uintmax_t>(left, block.size()));
+        out.write(block.data(), static_cast<std::streamsize>(n));
+        left -= n;
+    }
+    return path.string();
+}
+
+std::string label(std::uintmax_t bytes) {
+    if (bytes >= (1ull << 30))
+        return std::to_string(bytes >> 30) + "gb";
+    return std::to_string(bytes >> 20) + "mb";
+}
+
+void lines() {
+    for (const auto &[name, length] :
+         {std::pair{"short", 80}, std::pair{"1mb", 1 << 20}}) {
+        Line line(std::string(length, 'x'));
+        const double bytes = static_cast<double>(length);
+        measure(std::string("line/inschar/") + name, [&] {
+            // in and straight back out, so the line stays the same size
+            line.inschar(length / 2, 'y');
+            line.delchar(length / 2);
+            return std::size_t{2};
+        });
+        measure(
+            std::string("line/update_render/") + name,
+            [&] {
+                line.update_render();
+                return static_cast<std::size_t>(line.length() > 0);
+            },
+            bytes);
+    }
+}
+
+void opening(const std::vector<std::uintmax_t> &sizes) {
+    for (std::uintmax_t size : sizes) {
+        const std::string path = sample(size);
+        const double bytes = static_cast<double>(size);
+        const int rounds = size >= (100 << 20) ? 1 : 5;
+        measure(
+            "editor/open/" + label(size),
+            [&] {
+                Editor editor;
+                editor.open(path);
+                return std::size_t{1};
+            },
+            bytes, rounds, std::chrono::milliseconds{0});
+        if (size > (100 << 20))
+            continue;
+        for (openmode mode : {openmode::buffered, openmode::compact}) {
+            const std::string how = mode == openmode::buffered
+                                        ? "editor/open_buffered/"
+                                        : "editor/open_compact/";
+            measure(
+                how + label(size),
+                [&] {
+                    Editor editor;
+                    editor.open(path, mode);
+                    return std::size_t{1};
+                },
+                bytes, rounds, std::chrono::milliseconds{0});
+        }
+    }
+}
+
+// what a buffer holds per line with each way of keeping its lines, untouched
+// and with every 16th line edited
+void footprint(std::uintmax_t size) {
+    for (openmode mode :
+         {openmode::buffered, openmode::compact, openmode::mapped}) {
+        const std::string how = mode == openmode::buffered ? "buffered/"
+                                : mode == openmode::compact ? "compact/"
+                                                            : "mapped/";
+        if (!wanted("memory/" + how))
+            continue;
+        Editor editor;
+        editor.open(sample(size), mode);
+        const double count = editor.numlines();
+        for (const bool touched : {false, true}) {
+            if (touched) {
+                for (int i = 0; i < editor.numlines(); i += 16) {
+                    editor.point(i, 0);
+                    editor.inschar('x');
+                }
+            }
+            const Editor::usage used = editor.memory();
+            const std::string name = "memory/" + how +
+                                     (touched ? "edited/" : "opened/") +
+                                     label(size);
+            const double resident = static_cast<double>(used.resident());
+            results.push_back({{"name", name},
+                               {"bytes_per_line", resident / count},
+                               {"text_bytes_per_line",
+                                static_cast<double>(size) / count},
+                               {"resident_bytes", used.resident()},
+                               {"mapped_bytes", used.mapped}});
+            std::fprintf(stderr, "%-36s %14.1f bytes/line\n", name.c_str(),
+                         resident / count);
+        }
+    }
+}
+
+void editing(std::uintmax_t size) {
+    const std::string path = sample(size);
+    for (openmode mode :
+         {openmode::buffered, openmode::compact, openmode::mapped}) {
+        const std::string how = mode == openmode::buffered ? "buffered/"
+                                : mode == openmode::compact ? "compact/"
+                                                            : "mapped/";
+        Editor editor;
+        editor.open(path, mode);
+
+        measure("editor/insnewln_top/" + how + label(size), [&] {
+            editor.point(0, 0);
+            editor.insnewln_atptr();
+            return std::size_t{1};
+        });
+        measure(
+            "editor/dump/" + how + label(size),
+            [&] { return static_cast<std::size_t>(!editor.dump().empty()); },
+            static_cast<double>(size), 3, std::chrono::milliseconds{0});
+    }
+}
+
+void interface(std::uintmax_t size) {
+    const std::string path = sample(size);
+    // a headless terminal, so nothing measured here waits on a tty
+    auto headless = std::make_shared<HeadlessBackend>(thing{160, 50});
+    Workspace workspace;
+    Editor &editor = workspace.current().editor;
+    editor.open(path);
+    TUI ui(workspace, Terminal(headless));
+    ui.compose();
+
+    measure("tui/update_index/edit/" + label(size), [&] {
+        editor.point(editor.numlines() / 2, 0);
+        editor.inschar('x');
+        ui.update_index();
+        return std::size_t{1};
+    });
+
+    int columns = 160;
+    measure(
+        "tui/update_index/rewrap/" + label(size),
+        [&] {
+            columns = columns == 160 ? 159 : 160;
+            headless->resize({columns, 50});
+            ui.resize();
+            ui.update_index();
+            return std::size_t{1};
+        },
+        0, 3, std::chrono::milliseconds{0});
+
+    // jumps around the file, so the render cache only helps as much as it
+    // does for real scrolling
+    std::mt19937 rng(42);
+    measure("tui/draw_rows/" + label(size), [&] {
+        editor.point(static_cast<int>(rng() % editor.numlines()), 0);
+        ui.compose();
+        return std::size_t{1};
+    });
+    int top = 0;
+    measure("tui/draw_rows/scroll/" + label(size), [&] {
+        top = (top + 1) % editor.numlines();
+        editor.point(top, 0);
+        ui.compose();
+        return std::size_t{1};
+    });
+}
+
+} // namespace
+
+int main(int argc, char *argv[]) {
+    for (int i = 1; i < argc; i++) {
+        const std::string arg = argv[i];
+        if (arg == "--max-bytes" && i + 1 < argc) {
+            settings.maxbytes = std::stoull(argv[++i]);
+        } else if (arg == "--only" && i + 1 < argc) {
+            settings.only = argv[++i];
+        } else {
+            std::fprintf(stderr, "usage: %s [--max-bytes N] [--only NAME]\n",
+                         argv[0]);
+            return 1;
+        }
+    }
+
+    std::vector<std::uintmax_t> sizes;
+    for (std::uintmax_t size : {1ull << 20, 100ull << 20, 1ull << 30}) {
+        if (size <= settings.maxbytes)
+            sizes.push_back(size);
+    }
+
+    lines();
+    opening(sizes);
+    editing(std::min<std::uintmax_t>(settings.maxbytes, 100ull << 20));
+    interface(std::min<std::uintmax_t>(settings.maxbytes, 100ull << 20));
+    footprint(std::min<std::uintmax_t>(settings.maxbytes, 100ull << 20));
+
+    const nlohmann::ordered_json report = {
+        {"version", VERSION},
+        {"scan", scan::active().name},
+        {"threads", std::thread::hardware_concurrency()},
+        {"results", results}};
+    std::printf("%s\n", report.dump(2).c_str());
+    return 0;
+}
@@ -0,0 +1,181 @@
+// a local stand-in for a streaming completion endpoint
+
+#pragma once
+
+#include <arpa/inet.h>
+#include <cctype>
+#include <chrono>
+#include <cstdio>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <poll.h>
+#include <stdexcept>
+#include <stop_token>
+#include <string>
+#include <string_view>
+#include <sys/socket.h>
+#include <thread>
+#include <unistd.h>
+
+#include <nlohmann/json.hpp>
+
+// answers every POST on 127.0.0.1 with an OpenAI style chat completion
+// stream: `tokens` events of `token` each, the first after `first` and the
+// rest `gap` apart, then held open for `stall` before it ends, sent chunked
+// like the real thing. one connection at a time, which is all a single
+// editor ever opens.
+class MockServer {
+  public:
+    struct script {
+        int tokens = 200;
+        std::string token = "lorem ";
+        std::chrono::microseconds first{0};
+        std::chrono::microseconds gap{0};
+        std::chrono::microseconds stall{0}; // a model pausing at the end
+    };
+
+  private:
+    script plan;
+    int listener = -1;
+    int bound = 0;
+    std::jthread worker;
+
+    static bool send_all(int fd, std::string_view bytes) {
+        while (!bytes.empty()) {
+            const ssize_t sent =
+                ::send(fd, bytes.data(), bytes.size(), MSG_NOSIGNAL);
+            if (sent <= 0)
+                return false;
+            bytes.remove_prefix(static_cast<std::size_t>(sent));
+        }
+        return true;
+    }
+
+    static bool send_chunk(int fd, std::string_view payload) {
+        char size[32];
+        const int n =
+            std::snprintf(size, sizeof(size), "%zx\r\n", payload.size());
+        return send_all(fd, {size, static_cast<std::size_t>(n)}) &&
+               send_all(fd, payload) && send_all(fd, "\r\n");
+    }
+
+    // reads the headers and the body they announce, which is then ignored
+    static bool read_request(int fd) {
+        std::string in;
+        char bytes[4096];
+        std::size_t body = std::string::npos;
+        std::size_t length = 0;
+        while (body == std::string::npos || in.size() < body + length) {
+            const ssize_t got = recv(fd, bytes, sizeof(bytes), 0);
+            if (got <= 0)
+                return false;
+            in.append(bytes, static_cast<std::size_t>(got));
+            if (body == std::string::npos) {
+                const std::size_t end = in.find("\r\n\r\n");
+                if (end == std::string::npos)
+                    continue;
+                body = end + 4;
+                for (std::size_t at = in.find("\r\n"); at < end;
+                     at = in.find("\r\n", at + 2)) {
+                    static constexpr std::string_view field =
+                        "content-length:";
+                    std::string name = in.substr(at + 2, field.size());
+                    for (char &c : name)
+                        c = static_cast<char>(std::tolower(c));
+                    if (name == field)
+                        length = std::stoul(in.substr(at + 2 + field.size()));
+                }
+            }
+        }
+        return true;
+    }
+
+    void answer(int fd, std::stop_token stop) {
+        if (!read_request(fd))
+            return;
+        if (!send_all(fd, "HTTP/1.1 200 OK\r\n"
+                          "Content-Type: text/event-stream\r\n"
+                          "Transfer-Encoding: chunked\r\n"
+                          "Connection: close\r\n\r\n"))
+            return;
+
+        const std::string event =
+            "data: " +
+            nlohmann::json{
+                {"choices",
+                 {{{"index", 0}, {"delta", {{"content", plan.token}}}}}}}
+                .dump() +
+            "\n\n";
+        std::this_thread::sleep_for(plan.first);
+        for (int i = 0; i < plan.tokens && !stop.stop_requested(); i++) {
+            if (i > 0 && plan.gap.count() > 0)
+                std::this_thread::sleep_for(plan.gap);
+            if (!send_chunk(fd, event))
+                return;
+        }
+        // in small steps, so stopping the server doesn't wait it out
+        const auto until = std::chrono::steady_clock::now() + plan.stall;
+        while (!stop.stop_requested() &&
+               std::chrono::steady_clock::now() < until)
+            std::this_thread::sleep_for(std::chrono::milliseconds{5});
+        send_chunk(fd, "data: [DONE]\n\n");
+        send_all(fd, "0\r\n\r\n");
+    }
+
+    void serve(std::stop_token stop) {
+        while (!stop.stop_requested()) {
+            struct pollfd fd = {listener, POLLIN, 0};
+            if (poll(&fd, 1, 50) <= 0)
+                continue;
+            const int client = accept(listener, nullptr, nullptr);
+            if (client == -1)
+                continue;
+            const int on = 1;
+            setsockopt(client, IPPROTO_TCP, TCP_NODELAY, &on, sizeof(on));
+            answer(client, stop);
+            close(client);
+        }
+    }
+
+  public:
+    explicit MockServer(script plan, int port = 0)
+        : plan(std::move(plan)) {
+        listener = socket(AF_INET, SOCK_STREAM, 0);
+        if (listener == -1)
+            throw std::runtime_error("socket");
+        const int on = 1;
+        setsockopt(listener, SOL_SOCKET, SO_REUSEADDR, &on, sizeof(on));
+
+        sockaddr_in address{};
+        address.sin_family = AF_INET;
+        address.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+        address.sin_port = htons(static_cast<uint16_t>(port));
+        socklen_t size = sizeof(address);
+        if (bind(listener, reinterpret_cast<sockaddr *>(&address), size) ==
+                -1 ||
+            listen(listener, 4) == -1 ||
+            getsockname(listener, reinterpret_cast<sockaddr *>(&address),
+                        &size) == -1) {
+            close(listener);
+            throw std::runtime_error("failed to listen on 127.0.0.1");
+        }
+        bound = ntohs(address.sin_port);
+        worker = std::jthread([this](std::stop_token stop) { serve(stop); });
+    }
+
+    MockServer(const MockServer &) = delete;
+    MockServer &operator=(const MockServer &) = delete;
+
+    ~MockServer() {
+        worker.request_stop();
+        if (worker.joinable())
+            worker.join();
+        close(listener);
+    }
+
+    int port() const { return bound; }
+    std::string url() const {
+        return "http://127.0.0.1:" + std::to_string(bound) +
+               "/v1/chat/completions";
+    }
+};
@@ -0,0 +1,115 @@
+// scan kernels vs the scalar loops they replace
+
+#include <chrono>
+#include <cstdio>
+#include <functional>
+#include <string>
+
+#include "editor.hpp"
+#include "scan.hpp"
+
+namespace {
+
+volatile std::size_t sink;
+
+// best of a few runs, in MB/s over `bytes`
+double measure(std::size_t bytes, const std::function<std::size_t()> &work) {
+    double best = 0;
+    for (int run = 0; run < 5; run++) {
+        const auto start = std::chrono::steady_clock::now();
+        sink = work();
+        const std::chrono::duration<double> took =
+            std::chrono::steady_clock::now() - start;
+        best = std::max(best, static_cast<double>(bytes) / 1e6 / took.count());
+    }
+    return best;
+}
+
+std::size_t split(const scan::kernels &k, const std::string &text) {
+    std::size_t lines = 0;
+    const char *at = text.data();
+    const char *end = at + text.size();
+    while (at < end) {
+        at = k.find(at, end, '\n') + 1;
+        lines++;
+    }
+    return lines;
+}
+
+std::size_t columns(const scan::kernels &k, const std::string &text) {
+    // render_width(), but with the kernels passed in
+    std::size_t rx = 0;
+    const char *at = text.data();
+    const char *end = at + text.size();
+    while (true) {
+        const char *tab = k.find(at, end, '\t');
+        rx += static_cast<std::size_t>(tab - at);
+        if (tab == end)
+            return rx;
+        rx += TAB_SIZE - (rx % TAB_SIZE);
+        at = tab + 1;
+    }
+}
+
+std::size_t endings(const scan::kernels &k, const std::string &text) {
+    std::size_t found = 0;
+    const char *at = text.data();
+    const char *end = at + text.size();
+    while ((at = k.find2(at, end, '\n', '\r')) < end) {
+        at++;
+        found++;
+    }
+    return found;
+}
+
+void report(const char *what, const std::string &text) {
+    for (const scan::kernels *k : {&scan::scalar(), &scan::active()}) {
+        const char *first = text.data();
+        const char *last = first + text.size();
+        std::printf("%-10s %-8s split   %9.1f MB/s\n", what, k->name,
+                    measure(text.size(), [&] { return split(*k, text); }));
+        std::printf("%-10s %-8s endings %9.1f MB/s\n", what, k->name,
+                    measure(text.size(), [&] { return endings(*k, text); }));
+        std::printf("%-10s %-8s tabs    %9.1f MB/s\n", what, k->name,
+                    measure(text.size(),
+                            [&] { return k->count(first, last, '\t'); }));
+        std::printf("%-10s %-8s columns %9.1f MB/s\n", what, k->name,
+                    measure(text.size(), [&] { return columns(*k, text); }));
+        // a needle that never matches, so the whole buffer is searched
+        const std::string needle = "not in the text";
+        std::printf("%-10s %-8s search  %9.1f MB/s\n", what, k->name,
+                    measure(text.size(), [&] {
+                        return static_cast<std::size_t>(
+                            k->search(first, last, needle.data(),
+                                      needle.size()) -
+                            first);
+                    }));
+        // the whole buffer is ascii, so this too reads all of it
+        std::printf("%-10s %-8s ascii   %9.1f MB/s\n", what, k->name,
+                    measure(text.size(), [&] {
+                        return static_cast<std::size_t>(
+                            k->stop(first, last, '\x80', 0x80) - first);
+                    }));
+    }
+}
+
+} // namespace
+
+int main() {
+    // one 1 MiB line with a tab every few KiB
+    std::string longline(1 << 20, 'x');
+    for (std::size_t i = 0; i < longline.size(); i += 4093)
+        longline[i] = '\t';
+    report("longline", longline);
+
+    // 64 MiB of log-ish lines
+    const std::string entry =
+        "2026-01-01 00:00:00\tINFO\tworker 12 finished job 4312 in 18ms\n";
+    std::string file;
+    file.reserve(64 << 20);
+    while (file.size() + entry.size() <= (64 << 20))
+        file += entry;
+    report("largefile", file);
+
+    return 0;
+}
@@ -7,10 +7,16 @@
 #include <filesystem>
 #include <fstream>
 #include <iostream>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <sstream>
+#include <span>
 #include <stdarg.h>
 #include <stdexcept>
 #include <stdio.h>
 #include <string>
+#include <string_view>
 #include <sys/ioctl.h>
 #include <sys/socket.h>
 #include <sys/ttycom.h>
@@ -24,98 +30,838 @@
 namespace fs = std::filesystem;
 
 #include "extensions.hpp"
+#include "history.hpp"
+#include "mapped.hpp"
+#include "rope.hpp"
+#include "scan.hpp"
+#include "snapshot.hpp"
 #include "terminal.hpp"
+#include "utf8.hpp"
+
 constexpr int TAB_SIZE = 8;
 
-class Line {
-  public:
-    std::string chars;
-    std::string render;
-    int dirty;
+// render columns are what a line takes on screen: tabs expanded, east asian
+// wide characters two, combining marks none. runs of plain ascii, nearly all
+// of most text, are skipped a vector at a time as a column a byte.
 
-    int size() { return static_cast<int>(chars.size()); }
-    int length() { return static_cast<int>(render.size()); }
+// column `chars` ends on once tabs are expanded, when it starts on `rx`
+inline int render_width(std::string_view chars, int rx = 0) {
+    const char *at = chars.data();
+    const char *end = at + chars.size();
+    while (true) {
+        const char *stop = scan::stop(at, end, '\t', 0x80);
+        rx += static_cast<int>(stop - at);
+        at = stop;
+        if (at == end)
+            return rx;
+        if (*at == '\t') {
+            rx += TAB_SIZE - (rx % TAB_SIZE);
+            at++;
+            continue;
+        }
+        // multibyte characters tend to come in runs
+        do {
+            char32_t cp;
+            at += utf8::decode(at, end, cp);
+            rx += utf8::width(cp);
+        } while (at < end && static_cast<unsigned char>(*at) >= 0x80);
+    }
+}
 
-    void update_render() {
-        // fills the render buffer
-        int tabs = 0;
-        int ci;
+// render column of character `cx`
+inline int render_x(std::string_view chars, int cx) {
+    return render_width(chars.substr(0, std::max(0, cx)));
+}
 
-        for (ci = 0; ci < size(); ci++) {
-            if (chars[ci] == '\t')
-                tabs++;
+// character sitting at render column `rx`, tabs and wide characters count
+// as wherever they start and marks go with the character before them
+inline int char_at_rx(std::string_view chars, int rx) {
+    const char *begin = chars.data();
+    const char *end = begin + chars.size();
+    const char *at = begin;
+    int col = 0;
+    while (at < end) {
+        // everything up to the next tab or multibyte character is one column
+        // per byte
+        const char *stop = scan::stop(at, end, '\t', 0x80);
+        const int run = static_cast<int>(stop - at);
+        if (col + run > rx)
+            return static_cast<int>(at - begin) + std::max(0, rx - col);
+        col += run;
+        at = stop;
+        if (at == end)
+            break;
+
+        int length = 1;
+        int progress;
+        if (*at == '\t') {
+            progress = TAB_SIZE - (col % TAB_SIZE);
+        } else {
+            char32_t cp;
+            length = utf8::decode(at, end, cp);
+            progress = utf8::width(cp);
+        }
+        if (col + progress > rx)
+            return static_cast<int>(at - begin);
+        col += progress;
+        at += length;
+    }
+    return static_cast<int>(chars.size());
+}
+
+// writes `chars` into `out` with tabs expanded to spaces
+inline void expand_tabs(std::string_view chars, std::string &out) {
+    const char *at = chars.data();
+    const char *end = at + chars.size();
+    int col = 0;
+    out.clear();
+    out.reserve(chars.size() + scan::count(at, end, '\t') * (TAB_SIZE - 1));
+    while (true) {
+        const char *stop = scan::stop(at, end, '\t', 0x80);
+        out.append(at, stop);
+        col += static_cast<int>(stop - at);
+        at = stop;
+        if (at == end)
+            return;
+        if (*at == '\t') {
+            const int spaces = TAB_SIZE - (col % TAB_SIZE);
+            out.append(spaces, ' ');
+            col += spaces;
+            at++;
+            continue;
         }
+        char32_t cp;
+        const int length = utf8::decode(at, end, cp);
+        out.append(at, at + length);
+        col += utf8::width(cp);
+        at += length;
+    }
+}
+
+// calls `fn` with the render column each row after the first starts at, for
+// `chars` wrapped at `width` columns, until it returns false. rows break
+// every `width` columns, except that a wide character which would straddle
+// the edge starts the next row, leaving its row a column short. the cursor
+// past the end of a line gets a cell too.
+template <typename Fn>
+void wrap_rows(std::string_view chars, int width, Fn &&fn) {
+    const char *at = chars.data();
+    const char *end = at + chars.size();
+    int rowstart = 0;
+    int col = 0;
+    auto fill = [&] {
+        while (col >= rowstart + width) {
+            rowstart += width;
+            if (!fn(rowstart))
+                return false;
+        }
+        return true;
+    };
+    while (at < end) {
+        if (*at == '\t') {
+            // a tab splits across rows like the spaces it expands to
+            col += TAB_SIZE - (col % TAB_SIZE);
+            at++;
+            continue;
+        }
+        char32_t cp;
+        at += utf8::decode(at, end, cp);
+        const int w = utf8::width(cp);
+        if (w == 0)
+            continue; // marks stay with whatever they are on
+        if (!fill())
+            return;
+        if (w == 2 && col + 2 > rowstart + width) {
+            rowstart = col;
+            if (!fn(rowstart))
+                return;
+        }
+        col += w;
+    }
+    fill();
+}
+
+// rows `chars` takes wrapped at `width` columns
+inline int wrapped_rows(std::string_view chars, int width) {
+    // a line that fits whole, or has nothing wide in it, wraps evenly
+    const int length = render_width(chars);
+    if (length < width || utf8::narrow(chars))
+        return length / width + 1;
+    int rows = 1;
+    wrap_rows(chars, width, [&](int) { return ++rows, true; });
+    return rows;
+}
+
+// where the rows of a line wrapped at `width` columns start, found in one
+// walk along it. a narrow line has a row every `width` columns and keeps no
+// table; only one with something wide in it lists each row's column, and
+// only one that isn't all ascii the byte its rendered text starts each row
+// at.
+struct wrapping {
+    int width = 1;
+    int length = 0; // render columns of the whole line
+    bool narrow = true;
+    bool ascii = true;
+    std::vector<int> starts;        // column each row starts at
+    std::vector<std::size_t> bytes; // and its byte in the rendered text
+
+    int rows() const {
+        return narrow ? length / width + 1 : static_cast<int>(starts.size());
+    }
+
+    // render column row `nth` starts at
+    int start(int nth) const {
+        if (nth <= 0)
+            return 0;
+        return narrow ? nth * width : starts[std::min(nth, rows() - 1)];
+    }
+
+    // which row holds render column `rx`
+    int row_of(int rx) const {
+        if (narrow)
+            return rx / width;
+        const auto after = std::upper_bound(starts.begin(), starts.end(), rx);
+        return std::max(0, static_cast<int>(after - starts.begin()) - 1);
+    }
 
-        render.clear();
-        render.reserve(chars.size() + tabs * (TAB_SIZE - 1) + 1);
+    // byte of the tab-expanded text row `nth` starts at
+    std::size_t byte(int nth) const {
+        if (ascii)
+            return static_cast<std::size_t>(start(nth));
+        return bytes[std::clamp(nth, 0, rows() - 1)];
+    }
+};
+
+// the rows of `chars` wrapped at `width` columns, broken the way wrap_rows()
+// breaks them
+inline wrapping wrap(std::string_view chars, int width) {
+    wrapping out;
+    out.width = std::max(1, width);
+    out.ascii = utf8::ascii(chars);
+    out.narrow = out.ascii || utf8::narrow(chars);
+    if (out.ascii) {
+        out.length = render_width(chars);
+        return out;
+    }
 
-        for (char c : chars) {
-            if (c == '\t') {
-                render.push_back(' ');
-                while (render.size() % TAB_SIZE != 0)
-                    render.push_back(' ');
-            } else {
-                render.push_back(c);
+    const char *at = chars.data();
+    const char *end = at + chars.size();
+    int col = 0;
+    std::size_t byte = 0; // of the rendered text, where `col` is
+    int rowstart = 0;
+    // a row starting at a column already passed was passed over in spaces
+    // or ascii, a byte to a column
+    auto row = [&](int start) {
+        if (!out.narrow)
+            out.starts.push_back(start);
+        out.bytes.push_back(byte - static_cast<std::size_t>(col - start));
+    };
+    // rows starting at or before column `upto`
+    auto fill = [&](int upto) {
+        while (upto >= rowstart + out.width) {
+            rowstart += out.width;
+            row(rowstart);
+        }
+    };
+    row(0);
+    while (true) {
+        const char *stop = scan::stop(at, end, '\t', 0x80);
+        col += static_cast<int>(stop - at);
+        byte += static_cast<std::size_t>(stop - at);
+        at = stop;
+        if (at == end)
+            break;
+        if (*at == '\t') {
+            // a tab splits across rows like the spaces it expands to
+            const int spaces = TAB_SIZE - (col % TAB_SIZE);
+            col += spaces;
+            byte += static_cast<std::size_t>(spaces);
+            at++;
+            continue;
+        }
+        char32_t cp;
+        const int length = utf8::decode(at, end, cp);
+        const int w = utf8::width(cp);
+        at += length;
+        if (w == 0) {
+            // marks stay with whatever they are on, so rows that start
+            // where the mark sits still start after it
+            fill(col - 1);
+        } else {
+            fill(col);
+            if (w == 2 && col + 2 > rowstart + out.width) {
+                rowstart = col;
+                row(rowstart);
             }
         }
+        col += w;
+        byte += static_cast<std::size_t>(length);
     }
+    fill(col);
+    out.length = col;
+    return out;
+}
 
-    void inschar(int loc, echar ch) {
+class Line {
+  private:
+    // render width, worked out when first asked for. the expanded text
+    // itself is only built for lines on screen, see RenderCache.
+    int width = -1;
+
+    // one whole character at `loc`, not a tab, shifts the columns after it
+    // by its own width, unless a tab further on soaks the shift up. the
+    // byte at `after` follows it, and mustn't carry on a character.
+    bool shifts_evenly(int loc, std::string_view ch, int after) {
+        const char *end = chars.data() + chars.size();
+        return width >= 0 && !ch.empty() && ch[0] != '\t' &&
+               !utf8::continuation(ch[0]) && utf8::next(ch, 0) == ch.size() &&
+               !utf8::continuation(chars.c_str()[after]) &&
+               scan::find(chars.data() + loc, end, '\t') == end;
+    }
+
+  public:
+    std::string chars;
+    long version; // the editor revision it last changed at
+
+    int size() { return static_cast<int>(chars.size()); }
+    int length() {
+        if (width < 0)
+            width = render_width(chars);
+        return width;
+    }
+
+    // call after changing `chars` directly
+    void update_render() { width = -1; }
+
+    void insert(int loc, std::string_view text) {
         if (loc < 0 || loc > size())
             loc = size();
 
-        chars.insert(loc, 1, ch);
-        update_render();
-        dirty++;
+        const bool even = shifts_evenly(loc, text, loc);
+        chars.insert(loc, text);
+        if (even)
+            width += utf8::columns(text);
+        else
+            update_render();
     }
 
-    void delchar(int loc) {
+    void erase(int loc, int n) {
         if (loc < 0 || loc >= size())
             return;
+        n = std::min(n, size() - loc);
 
-        chars.erase(loc, 1);
-        update_render();
-        dirty++;
+        const std::string_view gone(chars.data() + loc,
+                                    static_cast<std::size_t>(n));
+        const bool even = shifts_evenly(loc, gone, loc + n);
+        const int columns = even ? utf8::columns(gone) : 0;
+        chars.erase(loc, n);
+        if (even)
+            width -= columns;
+        else
+            update_render();
     }
 
-    void append(std::string str) {
-        chars.append(str);
+    void inschar(int loc, echar ch) {
+        const char c = static_cast<char>(ch);
+        insert(loc, {&c, 1});
+    }
+
+    void delchar(int loc) { erase(loc, 1); }
 
-        update_render();
-        dirty++;
+    void append(std::string_view str) {
+        if (width >= 0)
+            width = render_width(str, width);
+        chars.append(str);
     }
 
-    int getrx(int cx) {
-        int rx = 0;
-        int ci;
+    int getrx(int cx) { return render_x(chars, cx); }
 
-        for (ci = 0; ci < cx; ci++) {
-            if (chars[ci] == '\t')
-                rx += (TAB_SIZE - 1) - (rx % TAB_SIZE);
-            rx++;
-        }
+    Line(std::string contents, long version = 0)
+        : chars(std::move(contents)), version(version) {}
+};
 
-        return rx;
-    }
+// a stretch of the buffer: either one line the editor owns, or a run of
+// untouched lines still living in a mapped file or a block read into memory
+struct piece {
+    std::optional<Line> line;
+    std::shared_ptr<MappedFile> source{}; // where a run's lines are
+    std::size_t first = 0;                // first line of the run in it
+    int count = 1;
+    long version = 0; // the revision the run arrived at
+};
 
-    Line(std::string contents) : chars(contents), dirty(0) { update_render(); }
+struct piece_measure {
+    int operator()(const piece &p) const { return p.line ? 1 : p.count; }
+};
+
+enum class openmode {
+    automatic, // map big files, read small ones compactly
+    buffered,  // a Line for every line
+    compact,   // one block, lines become Lines as they are edited
+    mapped,
 };
 
 class Editor {
   private:
-    int edirty;
-    std::vector<Line> lines;
+    // balanced tree, so mid-file line inserts are O(log n)
+    Rope<piece, piece_measure> lines;
+    std::shared_ptr<MappedFile> source; // the file a loader maps lines from
+    std::shared_ptr<std::mutex> guard; // may be shared with other editors
+    History history;
     struct editorspace {
         int lineid;
         int charid;
     } pointer;
 
+    static constexpr std::size_t MAXLOG = 4096;
+
+    long revision = 0;
+    long logbase = 0; // revision the log starts after
+    // log[i] took the buffer to revision logbase + i + 1. it has room for
+    // MAXLOG from the start and entries never move, so snapshots share it
+    // rather than copy it, each reading only what came before it.
+    std::shared_ptr<edit[]> log;
+    long edited = 0;       // revision of the last edit that wasn't a load
+    long cleaned = 0;      // revision the buffer was last saved or opened at
+    std::shared_ptr<const Snapshot> latest;
+
+    // owned lines go into snapshots this many to a chunk, so an edit only
+    // ever costs copying the chunk it landed in
+    static constexpr std::size_t CHUNKLINES = 256;
+
+    // at least this many lines put in at once share a block rather than
+    // getting a Line each
+    static constexpr std::size_t BLOCKLINES = 32;
+
+    // journals an edit and returns the revision it made. lines it leaves
+    // behind get stamped with that revision by the caller.
+    long record(int lineid, int removed, int added,
+                edit::kind what = edit::kind::edited) {
+        const auto logged = static_cast<std::size_t>(revision - logbase);
+        revision++;
+        if (what == edit::kind::edited)
+            edited = revision;
+        if (logged >= MAXLOG) {
+            // nobody should lag this far behind, readers start over instead.
+            // snapshots keep the old log, the next edit starts a new one.
+            log.reset();
+            logbase = revision;
+            return revision;
+        }
+        if (!log)
+            log = std::make_shared<edit[]>(MAXLOG);
+        log[logged] = {lineid, removed, added, what, revision};
+        return revision;
+    }
+
+    void forget() {
+        revision++;
+        log.reset();
+        logbase = revision;
+        latest.reset(); // nothing left worth sharing with
+    }
+
+    // makes sure a piece starts exactly at `lineid` and returns its position
+    std::size_t cut(int lineid) {
+        auto [at, before] =
+            lines.search([&](int sum) { return sum > lineid; });
+        if (at >= lines.size() || before == lineid)
+            return at;
+
+        piece &run = lines.at(at);
+        const int head = lineid - before;
+        piece tail{std::nullopt, run.source, run.first + head,
+                   run.count - head, run.version};
+        run.count = head;
+        lines.remeasure(at);
+        lines.insert(at + 1, std::move(tail));
+        return at + 1;
+    }
+
+    // turns line `index` into an owned Line, copying it out of the mapping
+    // the first time round
+    Line &materialize(int index) {
+        const std::size_t at = cut(index);
+        piece &p = lines.at(at);
+        if (!p.line) {
+            if (p.count > 1)
+                cut(index + 1);
+            p.line.emplace(std::string(p.source->line(p.first)), p.version);
+            p.source.reset();
+        }
+        return *p.line;
+    }
+
+    // whole lines [at, end), each ended by '\n', as pieces stamped `stamp`
+    void split_lines(const char *at, const char *end, long stamp,
+                     std::vector<piece> &into) {
+        const std::size_t count = scan::count(at, end, '\n');
+        // a '\r' could be read back as part of a "\r\n"
+        if (count >= BLOCKLINES && scan::find(at, end, '\r') == end) {
+            auto block = std::make_shared<MappedFile>(MappedFile::text,
+                                                      std::string(at, end));
+            const int lines = block->lines();
+            into.push_back({std::nullopt, std::move(block), 0, lines, stamp});
+            return;
+        }
+        for (const char *nl; (nl = scan::find(at, end, '\n')) != end;
+             at = nl + 1)
+            into.push_back({Line(std::string(at, nl), stamp)});
+    }
+
+    // the primitives below change the buffer without touching the undo
+    // history, the public edits log themselves before calling them
+
+    // puts `text` in at lineid:charid, splitting lines at each '\n', and
+    // returns where it ends. the new lines go in with one splice.
+    std::pair<int, int> put_text(int lineid, int charid, std::string_view text) {
+        Line &line = materialize(lineid);
+        charid = std::clamp(charid, 0, line.size());
+        const char *at = text.data();
+        const char *end = at + text.size();
+        const char *nl = scan::find(at, end, '\n');
+        if (nl == end) {
+            line.insert(charid, text);
+            line.version = record(lineid, 1, 1);
+            return {lineid, charid + static_cast<int>(text.size())};
+        }
+
+        const long stamp = revision + 1; // what record() below makes it
+        std::string tail(line.chars, charid);
+        line.chars.resize(charid);
+        line.chars.append(at, nl);
+        line.update_render();
+        line.version = stamp;
+
+        std::vector<piece> added;
+        const char *lastline = text.data() + text.rfind('\n') + 1;
+        split_lines(nl + 1, lastline, stamp, added);
+        std::string last(lastline, end);
+        const int endchar = static_cast<int>(last.size());
+        last.append(tail);
+        added.push_back({Line(std::move(last), stamp)});
+
+        const int count =
+            static_cast<int>(scan::count(text.data(), end, '\n'));
+        lines.splice(cut(lineid + 1), Rope<piece, piece_measure>(
+                                          std::move(added), lines.allocator()));
+        record(lineid, 1, 1 + count);
+        return {lineid + count, endchar};
+    }
+
+    // takes out the text from lineid:charid up to endline:endchar
+    std::string take_text(int lineid, int charid, int endline, int endchar) {
+        Line &first = materialize(lineid);
+        if (endline == lineid) {
+            std::string removed(first.chars, charid, endchar - charid);
+            first.erase(charid, static_cast<int>(removed.size()));
+            first.version = record(lineid, 1, 1);
+            return removed;
+        }
+
+        std::string removed(first.chars, charid);
+        std::string tail;
+        int at = lineid;
+        visit_lines(lineid + 1, [&](std::string_view chars) {
+            removed.push_back('\n');
+            if (++at < endline) {
+                removed.append(chars);
+                return true;
+            }
+            removed.append(chars.substr(0, endchar));
+            tail = chars.substr(endchar);
+            return false;
+        });
+
+        first.chars.resize(charid);
+        first.chars.append(tail);
+        first.update_render();
+        first.version = revision + 1;
+        const std::size_t from = cut(lineid + 1);
+        lines.erase(from, cut(endline + 1));
+        record(lineid, 1 + endline - lineid, 1);
+        return removed;
+    }
+
+    // puts in whole lines before `where`, `text` being them joined by '\n'
+    int put_lines(int where, std::string_view text) {
+        const long stamp = revision + 1;
+        std::vector<piece> added;
+        const char *end = text.data() + text.size();
+        const std::size_t nl = text.rfind('\n');
+        const char *lastline =
+            nl == std::string_view::npos ? text.data() : text.data() + nl + 1;
+        split_lines(text.data(), lastline, stamp, added);
+        added.push_back({Line(std::string(lastline, end), stamp)});
+
+        const int count =
+            1 + static_cast<int>(scan::count(text.data(), end, '\n'));
+        lines.splice(cut(where), Rope<piece, piece_measure>(
+                                     std::move(added), lines.allocator()));
+        record(where, 0, count);
+        return count;
+    }
+
+    // takes out `count` whole lines from `where`, returning them joined by
+    // '\n'
+    std::string take_lines(int where, int count) {
+        std::string removed;
+        int seen = 0;
+        visit_lines(where, [&](std::string_view chars) {
+            if (seen++ > 0)
+                removed.push_back('\n');
+            removed.append(chars);
+            return seen < count;
+        });
+        const std::size_t from = cut(where);
+        lines.erase(from, cut(where + count));
+        record(where, count, 0);
+        return removed;
+    }
+
+    // first `needle` at or after lineid:charid, in lines before `endline`.
+    // untouched mapped runs are searched as one block of bytes, so a run of
+    // a million lines costs one kernel call rather than a million.
+    std::optional<std::pair<int, int>>
+    find_before(std::string_view needle, int lineid, int charid, int endline) {
+        std::optional<std::pair<int, int>> hit;
+        auto [at, before] = lines.search([&](int sum) { return sum > lineid; });
+        int index = before;
+        lines.visit(at, [&](const piece &p) {
+            if (index >= endline)
+                return false;
+            if (p.line) {
+                const std::string &chars = p.line->chars;
+                const std::size_t from =
+                    index == lineid ? std::min<std::size_t>(charid, chars.size())
+                                    : 0;
+                const char *end = chars.data() + chars.size();
+                const char *found = scan::search(chars.data() + from, end,
+                                                 needle.data(), needle.size());
+                if (found != end) {
+                    hit = {index, static_cast<int>(found - chars.data())};
+                    return false;
+                }
+                index++;
+                return true;
+            }
+
+            const int skip = std::max(0, lineid - index);
+            const int count = std::min(p.count, endline - index) - skip;
+            const std::string_view bytes =
+                p.source->span(p.first + skip, count);
+            std::size_t from = 0;
+            if (index + skip == lineid)
+                from = std::min<std::size_t>(
+                    charid, p.source->line(p.first + skip).size());
+            const char *end = bytes.data() + bytes.size();
+            const char *found = scan::search(bytes.data() + from, end,
+                                             needle.data(), needle.size());
+            if (found != end) {
+                // a needle has no '\n', so it never straddles two lines
+                const std::size_t offset = p.source->start_of(p.first + skip) +
+                                           (found - bytes.data());
+                const std::size_t line = p.source->line_of(offset);
+                hit = {index + static_cast<int>(line - p.first),
+                       static_cast<int>(offset - p.source->start_of(line))};
+                return false;
+            }
+            index += p.count;
+            return true;
+        });
+        return hit;
+    }
+
+    // where `text` put in at lineid:charid ends
+    static std::pair<int, int> end_of(int lineid, int charid,
+                                      std::string_view text) {
+        const std::size_t nl = text.rfind('\n');
+        if (nl == std::string_view::npos)
+            return {lineid, charid + static_cast<int>(text.size())};
+        const int newlines = static_cast<int>(
+            scan::count(text.data(), text.data() + text.size(), '\n'));
+        return {lineid + newlines, static_cast<int>(text.size() - nl - 1)};
+    }
+
+    // adds lines [from, to) to `snap` as fresh chunks
+    void freeze(Snapshot &snap, int from, int to) {
+        if (from >= to)
+            return;
+        auto [at, before] = lines.search([&](int sum) { return sum > from; });
+        int index = from;
+        int skip = from - before;
+        std::shared_ptr<chunk> owned;
+        lines.visit(at, [&](const piece &p) {
+            if (index >= to)
+                return false;
+            if (p.line) {
+                if (!owned || owned->owned.size() >= CHUNKLINES) {
+                    owned = std::make_shared<chunk>();
+                    snap.chunks.push_back(owned);
+                }
+                owned->owned.push_back(p.line->chars);
+                index++;
+                return true;
+            }
+
+            auto run = std::make_shared<chunk>();
+            run->file = p.source;
+            run->first = p.first + skip;
+            run->count = std::min(p.count - skip, to - index);
+            if (!p.source->indexed()) {
+                // the loader still grows the file's table under the lock,
+                // so readers without it get a copy of their slice
+                run->base = p.source->span(run->first, run->count).data();
+                for (int i = 0; i <= run->count; i++)
+                    run->starts.push_back(
+                        p.source->start_of(run->first + i));
+            }
+            snap.chunks.push_back(std::move(run));
+            owned.reset();
+            index += p.count - skip;
+            skip = 0;
+            return true;
+        });
+    }
+
+    void revert(const History::change &c) {
+        const std::string text = history.text(c);
+        switch (c.what) {
+        case History::kind::inserted: {
+            auto [endline, endchar] = end_of(c.lineid, c.charid, text);
+            take_text(c.lineid, c.charid, endline, endchar);
+            point(c.lineid, c.charid);
+            break;
+        }
+        case History::kind::erased: {
+            auto [endline, endchar] = put_text(c.lineid, c.charid, text);
+            point(endline, endchar);
+            break;
+        }
+        case History::kind::lines_added:
+            take_lines(c.lineid, 1 + static_cast<int>(scan::count(
+                                         text.data(), text.data() + text.size(),
+                                         '\n')));
+            point(c.lineid, 0);
+            break;
+        case History::kind::lines_removed:
+            put_lines(c.lineid, text);
+            point(c.lineid, 0);
+            break;
+        }
+    }
+
+    void reapply(const History::change &c) {
+        const std::string text = history.text(c);
+        switch (c.what) {
+        case History::kind::inserted: {
+            auto [endline, endchar] = put_text(c.lineid, c.charid, text);
+            point(endline, endchar);
+            break;
+        }
+        case History::kind::erased: {
+            auto [endline, endchar] = end_of(c.lineid, c.charid, text);
+            take_text(c.lineid, c.charid, endline, endchar);
+            point(c.lineid, c.charid);
+            break;
+        }
+        case History::kind::lines_added:
+            put_lines(c.lineid, text);
+            point(c.lineid, 0);
+            break;
+        case History::kind::lines_removed:
+            take_lines(c.lineid, 1 + static_cast<int>(scan::count(
+                                         text.data(), text.data() + text.size(),
+                                         '\n')));
+            point(c.lineid, 0);
+            break;
+        }
+    }
+
   public:
+    // files at least this big get mapped rather than read
+    static constexpr std::uintmax_t MAPTHRESHOLD = 1 << 20;
+
     std::string fileName;
 
-    Editor() : edirty(0), lines{}, pointer{0, 0}, fileName{} {}
+    // `slabs` are where the line tree's nodes come from, shared by the
+    // editors of a workspace
+    explicit Editor(
+        std::shared_ptr<std::mutex> guard = std::make_shared<std::mutex>(),
+        std::shared_ptr<Slabs> slabs = Slabs::fallback())
+        : lines(std::move(slabs)), guard(std::move(guard)), pointer{0, 0},
+          fileName{} {}
+
+    int numlines() { return lines.total(); }
+
+    long version() { return revision; }
+
+    // the revision line `index` last changed at. lines still in the mapped
+    // file carry the revision their run arrived at, which may be later.
+    long line_version(int index) {
+        if (lines.empty())
+            return 0;
+        index = std::clamp(index, 0, numlines() - 1);
+        auto [at, before] = lines.search([&](int sum) { return sum > index; });
+        const piece &p = lines.at(at);
+        return p.line ? p.line->version : p.version;
+    }
+
+    // edits made after revision `since`, oldest first. nullopt means the log
+    // no longer reaches back that far and the reader has to start over.
+    std::optional<std::span<const edit>> edits_since(long since) {
+        if (since < logbase || since > revision)
+            return std::nullopt;
+        return std::span<const edit>(
+            log.get() + (since - logbase),
+            static_cast<std::size_t>(revision - since));
+    }
+
+    // an immutable copy of the buffer as it is now, for readers on other
+    // threads. only what changed since the last one is copied, the rest is
+    // shared with it, and mapped runs are never copied at all.
+    std::shared_ptr<const Snapshot> snapshot() {
+        if (latest && latest->version() == revision)
+            return latest;
 
-    int numlines() { return static_cast<int>(lines.size()); }
+        auto next = std::make_shared<Snapshot>();
+        next->revision = revision;
+        next->logbase = logbase;
+        next->log = log; // shared, not copied
+
+        int at = 0;
+        if (latest) {
+            if (auto edits = edits_since(latest->version())) {
+                for (auto &[first, kept] : latest->survivors(*edits)) {
+                    freeze(*next, at, first);
+                    next->chunks.push_back(kept);
+                    at = first + kept->size();
+                }
+            }
+        }
+        freeze(*next, at, numlines());
+        next->index();
+        latest = next;
+        return latest;
+    }
+
+    // walks the text of each line in order from `from`, stopping once `fn`
+    // returns false. mapped lines are handed out without copying them.
+    template <typename Fn> void visit_lines(int from, Fn &&fn) {
+        from = std::max(from, 0);
+        auto [at, before] = lines.search([&](int sum) { return sum > from; });
+        int skip = from - before;
+        lines.visit(at, [&](piece &p) {
+            if (p.line)
+                return static_cast<bool>(fn(std::string_view(p.line->chars)));
+            for (int i = skip; i < p.count; i++) {
+                if (!fn(p.source->line(p.first + i)))
+                    return false;
+            }
+            skip = 0;
+            return true;
+        });
+    }
 
     int pointer_linepos() { return pointer.lineid; }
     int pointer_charpos() { return pointer.charid; }
@@ -125,7 +871,113 @@ class Editor {
             throw std::out_of_range("line_index(): no lines to reference!");
         } // dereferencing a nonexistent line will crash
         index = std::clamp(index, 0, numlines() - 1);
-        return lines[index];
+        return materialize(index);
+    }
+
+    // read-only text of a line. unlike line_at() this never pulls a mapped
+    // line into owned storage.
+    std::string_view chars_at(int index) {
+        if (lines.empty()) {
+            throw std::out_of_range("chars_at(): no lines to reference!");
+        }
+        index = std::clamp(index, 0, numlines() - 1);
+        auto [at, before] = lines.search([&](int sum) { return sum > index; });
+        const piece &p = lines.at(at);
+        if (p.line)
+            return p.line->chars;
+        return p.source->line(p.first + (index - before));
+    }
+
+    // render columns of a line
+    int width_at(int index) {
+        if (lines.empty())
+            return 0;
+        index = std::clamp(index, 0, numlines() - 1);
+        auto [at, before] = lines.search([&](int sum) { return sum > index; });
+        piece &p = lines.at(at);
+        if (p.line)
+            return p.line->length();
+        return render_width(p.source->line(p.first + (index - before)));
+    }
+
+    bool mapped() { return source != nullptr; }
+
+    // held by whoever is reading or changing the buffer while a loader
+    // thread may be streaming lines into it
+    std::unique_lock<std::mutex> lock() {
+        return std::unique_lock<std::mutex>(*guard);
+    }
+
+    // starts over on a mapped file whose lines arrive later through extend()
+    void adopt(std::shared_ptr<MappedFile> file, const std::string &name) {
+        lines.clear();
+        source = std::move(file);
+        fileName = name;
+        pointer = {0, 0};
+        history.clear();
+        forget();
+        clean();
+    }
+
+    // appends `count` more lines of the mapped file, starting at `first`.
+    // loading is not an edit, so the buffer stays clean.
+    void extend(std::size_t first, int count) {
+        if (count <= 0)
+            return;
+        const int at = numlines();
+        if (!lines.empty()) {
+            piece &last = lines.at(lines.size() - 1);
+            if (!last.line && last.source == source &&
+                last.first + last.count == first) {
+                last.count += count;
+                lines.remeasure(lines.size() - 1);
+                last.version = record(at, 0, count, edit::kind::loaded);
+                return;
+            }
+        }
+        lines.push_back({std::nullopt, source, first, count,
+                         record(at, 0, count, edit::kind::loaded)});
+    }
+
+    // every mapping and block untouched lines are read from, to be kept
+    // alive by whoever reads them later without the lock
+    std::vector<std::shared_ptr<const MappedFile>> sources() {
+        std::vector<std::shared_ptr<const MappedFile>> found;
+        lines.for_each([&](const piece &p) {
+            if (p.source && (found.empty() || found.back() != p.source))
+                found.push_back(p.source);
+        });
+        std::sort(found.begin(), found.end());
+        found.erase(std::unique(found.begin(), found.end()), found.end());
+        return found;
+    }
+
+    // walks the buffer as it would be saved, each line followed by '\n', in
+    // as few spans as possible: an untouched mapped run whose bytes already
+    // are its saved form comes out as one span straight from the mapping.
+    // `owned` tells whether a span points into an edited line.
+    template <typename Fn> void visit_spans(Fn &&fn) {
+        static constexpr std::string_view newline = "\n";
+        lines.for_each([&](const piece &p) {
+            if (p.line) {
+                fn(std::string_view(p.line->chars), true);
+                fn(newline, false);
+                return;
+            }
+            const std::string_view run = p.source->span(p.first, p.count);
+            const char *end = run.data() + run.size();
+            if (scan::find(run.data(), end, '\r') == end) {
+                fn(run, false);
+                if (run.empty() || run.back() != '\n')
+                    fn(newline, false); // the file's last line had none
+                return;
+            }
+            // "\r\n" endings are saved as '\n', line by line
+            for (int i = 0; i < p.count; i++) {
+                fn(p.source->line(p.first + i), false);
+                fn(newline, false);
+            }
+        });
     }
 
     void point(int lineid, int charid) {
@@ -140,30 +992,87 @@ class Editor {
             return;
         }
 
-        charid = std::clamp(charid, 0, lines[lineid].size());
+        charid = std::clamp(charid, 0, static_cast<int>(chars_at(lineid).size()));
         pointer = {lineid, charid};
     }
 
-    void open(const std::string &filepath) {
+    void open(const std::string &filepath,
+              openmode mode = openmode::automatic) {
         const fs::path path(filepath);
         if (!fs::exists(path))
             throw std::runtime_error("file not found: " + filepath);
 
-        std::ifstream in(path);
-        if (!in)
-            throw std::runtime_error("failed to open: " + filepath);
+        if (mode == openmode::automatic) {
+            const bool big = fs::is_regular_file(path) &&
+                             fs::file_size(path) >= MAPTHRESHOLD;
+            mode = big ? openmode::mapped : openmode::compact;
+        }
 
-        fileName = fs::canonical(path).string();
-        lines.clear();
+        if (mode == openmode::mapped) {
+            // only the line offsets are worked out now, Lines get made as
+            // they are touched
+            auto file = std::make_shared<MappedFile>(path.string());
+            std::vector<piece> runs;
+            if (file->lines() > 0)
+                runs.push_back({std::nullopt, file, 0, file->lines()});
+            lines.assign(std::move(runs));
+            source = std::move(file);
+        } else if (mode == openmode::compact) {
+            // one read, one block and one table of where its lines start.
+            // Lines get made as they are touched, as for a mapped file.
+            std::ifstream in(path, std::ios::binary);
+            if (!in)
+                throw std::runtime_error("failed to open: " + filepath);
+            std::ostringstream slurp;
+            slurp << in.rdbuf();
+            auto block = std::make_shared<MappedFile>(MappedFile::text,
+                                                      std::move(slurp).str());
+            std::vector<piece> runs;
+            if (block->lines() > 0)
+                runs.push_back({std::nullopt, block, 0, block->lines()});
+            lines.assign(std::move(runs));
+            source.reset();
+        } else {
+            std::ifstream in(path, std::ios::binary);
+            if (!in)
+                throw std::runtime_error("failed to open: " + filepath);
+            std::ostringstream slurp;
+            slurp << in.rdbuf();
+            const std::string text = std::move(slurp).str();
+
+            // lines end at "\n" or "\r\n", a lone '\r' is part of the line
+            std::vector<piece> loaded;
+            std::string get;
+            const char *at = text.data();
+            const char *end = at + text.size();
+            const char *linestart = at;
+            while (at < end) {
+                const char *stop = scan::find2(at, end, '\n', '\r');
+                get.append(at, stop);
+                if (stop == end || (*stop == '\r' && stop + 1 == end))
+                    break; // a trailing '\r' goes, as with "\r\n"
+                if (*stop == '\r' && stop[1] != '\n') {
+                    get.push_back('\r');
+                    at = stop + 1;
+                    continue;
+                }
+                loaded.push_back({Line(std::move(get))});
+                get.clear();
+                at = stop + (*stop == '\r' ? 2 : 1);
+                linestart = at;
+            }
+            if (linestart < end) // last line without a terminator
+                loaded.push_back({Line(std::move(get))});
 
-        std::string get;
-        while (std::getline(in, get)) {
-            // std::getline discards the delimiter '\n' by default
-            if (!get.empty() && get.back() == '\r')
-                get.pop_back();
-            insln(numlines(), get);
+            // builds the tree in one O(n) pass
+            lines.assign(std::move(loaded));
+            source.reset();
         }
 
+        fileName = fs::canonical(path).string();
+        pointer = {0, 0};
+        history.clear();
+        forget();
         clean();
     }
 
@@ -171,42 +1080,118 @@ class Editor {
         if (which < 0 || which >= numlines())
             return;
 
-        lines.erase(lines.begin() + which);
-        edirty++;
+        history.lines_removed(which, chars_at(which));
+        const std::size_t first = cut(which);
+        lines.erase(first, cut(which + 1));
+        record(which, 1, 0);
     }
 
     void insln(int where, std::string contents) {
         if (where < 0 || where > numlines())
             return;
 
-        lines.insert(lines.begin() + where, Line(contents));
+        history.lines_added(where, contents);
+        lines.insert(cut(where), {Line(std::move(contents), revision + 1)});
+        record(where, 0, 1);
+    }
 
-        edirty++;
+    // puts `text` in at lineid:charid and returns where it ends. a lineid
+    // one past the last line starts a new line.
+    std::pair<int, int> insert_text(int lineid, int charid,
+                                    std::string_view text) {
+        lineid = std::clamp(lineid, 0, numlines());
+        if (lineid == numlines()) {
+            insln(lineid, "");
+            history.join();
+        }
+        charid = std::clamp(charid, 0, static_cast<int>(chars_at(lineid).size()));
+        history.inserted(lineid, charid, text);
+        return put_text(lineid, charid, text);
     }
 
-    void inschar(echar ch) {
+    // takes out the text between two positions and returns it
+    std::string erase_text(int lineid, int charid, int endline, int endchar) {
+        if (numlines() == 0)
+            return {};
+        if (std::pair(endline, endchar) < std::pair(lineid, charid)) {
+            std::swap(lineid, endline);
+            std::swap(charid, endchar);
+        }
+        lineid = std::clamp(lineid, 0, numlines() - 1);
+        endline = std::clamp(endline, lineid, numlines() - 1);
+        charid = std::clamp(charid, 0, static_cast<int>(chars_at(lineid).size()));
+        endchar = std::clamp(endchar, 0, static_cast<int>(chars_at(endline).size()));
+        if (endline == lineid && endchar <= charid)
+            return {};
+
+        std::string removed = take_text(lineid, charid, endline, endchar);
+        history.erased(lineid, charid, removed);
+        return removed;
+    }
+
+    // takes back the last group of edits, false when there is none
+    bool undo() {
+        auto group = history.undo();
+        for (auto c = group.rbegin(); c != group.rend(); ++c)
+            revert(*c);
+        return !group.empty();
+    }
+
+    bool redo() {
+        auto group = history.redo();
+        for (const History::change &c : group)
+            reapply(c);
+        return !group.empty();
+    }
+
+    // ends the current undo group, so typing after e.g. a cursor move is
+    // undone on its own
+    void checkpoint() { history.seal(); }
+
+    // how many bytes the undo history may hold before its oldest groups go
+    void set_undo_limit(std::size_t bytes) { history.set_limit(bytes); }
+
+    // first `needle` at or after lineid:charid, wrapping around past the end
+    std::optional<std::pair<int, int>> find(std::string_view needle,
+                                            int lineid, int charid) {
+        if (needle.empty() || lines.empty())
+            return std::nullopt;
+        lineid = std::clamp(lineid, 0, numlines() - 1);
+        if (auto hit = find_before(needle, lineid, charid, numlines()))
+            return hit;
+        return find_before(needle, 0, 0, lineid + 1);
+    }
+
+    // puts in one character, given as the bytes that encode it
+    void inschar(std::string_view ch) {
         if (pointer.lineid == numlines()) {
             insln(numlines(), "");
+            history.join();
         }
 
-        lines[pointer.lineid].inschar(pointer.charid, ch);
-        pointer.charid++;
+        Line &line = materialize(pointer.lineid);
+        pointer.charid = std::clamp(pointer.charid, 0, line.size());
+        history.inserted(pointer.lineid, pointer.charid, ch);
+        line.insert(pointer.charid, ch);
+        line.version = record(pointer.lineid, 1, 1);
+        pointer.charid += static_cast<int>(ch.size());
+    }
+
+    void inschar(echar ch) {
+        const char c = static_cast<char>(ch);
+        inschar(std::string_view(&c, 1));
     }
 
     void insnewln_atptr() {
         if (pointer.charid == 0) {
             insln(pointer.lineid, "");
-        } else {
-            Line &currentln = line_at(pointer.lineid);
-            std::string fragment;
-            fragment = currentln.chars.substr(pointer.charid);
-            currentln.chars.erase(pointer.charid);
-            currentln.update_render();
-            insln(pointer.lineid + 1, std::move(fragment));
+            pointer.lineid++;
+            return;
         }
-
-        pointer.lineid++;
-        pointer.charid = 0;
+        // only the tail span moves to the new line, the head stays put
+        auto [lineid, charid] =
+            insert_text(pointer.lineid, pointer.charid, "\n");
+        pointer = {lineid, charid};
     }
 
     void delchar() {
@@ -215,41 +1200,73 @@ class Editor {
         if (pointer.charid == 0 && pointer.lineid == 0)
             return;
 
-        Line &current = line_at(pointer.lineid);
         if (pointer.charid > 0) {
-            lines[pointer.lineid].delchar(pointer.charid - 1);
-            pointer.charid--;
+            Line &current = line_at(pointer.lineid);
+            pointer.charid = std::min(pointer.charid, current.size());
+            // the whole character before the pointer, however many bytes
+            const int at = static_cast<int>(
+                utf8::previous(current.chars, pointer.charid));
+            const int n = pointer.charid - at;
+            history.erased(pointer.lineid, at,
+                           {&current.chars[at], static_cast<std::size_t>(n)},
+                           true);
+            current.erase(at, n);
+            current.version = record(pointer.lineid, 1, 1);
+            pointer.charid = at;
         } else {
+            // joins this line onto the one above
             const int line_above = pointer.lineid - 1;
-            Line &previous = line_at(line_above);
-            pointer.charid = previous.size();
-            previous.append(current.chars);
-            delln(pointer.lineid);
-            pointer.lineid = line_above;
+            const int joint = static_cast<int>(chars_at(line_above).size());
+            erase_text(line_above, joint, pointer.lineid, 0);
+            pointer = {line_above, joint};
         }
     }
 
     std::string dump() {
         std::string dump;
-        for (Line line : lines) {
-            dump.append(line.chars);
+        visit_lines(0, [&](std::string_view chars) {
+            dump.append(chars);
             dump.push_back('\n');
-        }
+            return true;
+        });
         return dump;
     }
 
-    int dirty() {
-        int count = edirty;
-        for (Line &line : lines) {
-            count += line.dirty;
+    // roughly what the buffer keeps in memory, by where it lives. walks the
+    // whole tree, so it is for reports rather than every frame.
+    struct usage {
+        std::size_t lines = 0;   // edited lines and the tree over all lines
+        std::size_t blocks = 0;  // text read into memory, not yet edited
+        std::size_t table = 0;   // where each untouched line starts
+        std::size_t history = 0; // undo and redo
+        std::size_t mapped = 0;  // mapped files, paged in as they are read
+
+        std::size_t resident() const {
+            return lines + blocks + table + history;
         }
-        return count;
-    }
+    };
 
-    void clean() {
-        edirty = 0;
-        for (Line &line : lines) { // by refernce to actually change th elines
-            line.dirty = 0;
+    usage memory() {
+        static const std::size_t inplace = std::string().capacity();
+        usage used;
+        lines.for_each([&](const piece &p) {
+            used.lines += decltype(lines)::NODEBYTES;
+            if (p.line && p.line->chars.capacity() > inplace)
+                used.lines += p.line->chars.capacity() + 1;
+        });
+        auto files = sources();
+        if (source && !std::binary_search(files.begin(), files.end(), source))
+            files.push_back(source); // nothing of it has arrived yet
+        for (const auto &file : files) {
+            used.table += file->table_bytes();
+            (file->resident() ? used.blocks : used.mapped) += file->size();
         }
+        used.history = history.bytes();
+        return used;
     }
+
+    // whether anything was edited since the last clean(), loading aside
+    bool dirty() const { return edited > cleaned; }
+
+    void clean() { cleaned = revision; }
 };
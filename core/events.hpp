@@ -0,0 +1,179 @@
+// event loop
+
+#pragma once
+
+#include <algorithm>
+#include <cerrno>
+#include <chrono>
+#include <csignal>
+#include <fcntl.h>
+#include <optional>
+#include <poll.h>
+#include <queue>
+#include <stdexcept>
+#include <unistd.h>
+#include <vector>
+
+#if defined(__linux__)
+#include <sys/signalfd.h>
+#endif
+
+// waits on stdin, window resizes, timers and other threads in one poll(2),
+// so an idle editor sleeps until something actually happens. resizes come
+// through signalfd on linux and a self-pipe elsewhere. construct it before
+// any thread is started, so they all inherit the blocked SIGWINCH.
+class EventLoop {
+  public:
+    using clock = std::chrono::steady_clock;
+
+    struct happened {
+        bool input = false;
+        bool resized = false;
+        bool timer = false;
+        bool woken = false; // another thread called notify()
+    };
+
+  private:
+    int input;
+    int resizefd = -1;
+    int wakefds[2] = {-1, -1};
+#if !defined(__linux__)
+    int resizewrite = -1;
+    static inline int signalled = -1; // write end the handler reaches
+
+    static void on_resize(int) {
+        const int saved = errno;
+        const char byte = 0;
+        [[maybe_unused]] auto ignored = write(signalled, &byte, 1);
+        errno = saved;
+    }
+#endif
+
+    std::priority_queue<clock::time_point, std::vector<clock::time_point>,
+                        std::greater<>>
+        deadlines;
+
+    static void drain(int fd) {
+        char bytes[64];
+        while (read(fd, bytes, sizeof(bytes)) > 0) {
+        }
+    }
+
+    void drain_resizes() {
+#if defined(__linux__)
+        signalfd_siginfo info;
+        while (read(resizefd, &info, sizeof(info)) == sizeof(info)) {
+        }
+#else
+        drain(resizefd);
+#endif
+    }
+
+  public:
+    // `input` is the descriptor keys arrive on, -1 for none
+    explicit EventLoop(int input = STDIN_FILENO) : input(input) {
+        if (pipe(wakefds) == -1)
+            throw std::runtime_error("pipe");
+        for (int fd : wakefds) {
+            fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) | O_NONBLOCK);
+            fcntl(fd, F_SETFD, FD_CLOEXEC);
+        }
+#if defined(__linux__)
+        sigset_t mask;
+        sigemptyset(&mask);
+        sigaddset(&mask, SIGWINCH);
+        if (sigprocmask(SIG_BLOCK, &mask, nullptr) == -1)
+            throw std::runtime_error("sigprocmask");
+        resizefd = signalfd(-1, &mask, SFD_NONBLOCK | SFD_CLOEXEC);
+        if (resizefd == -1)
+            throw std::runtime_error("signalfd");
+#else
+        int ends[2];
+        if (pipe(ends) == -1)
+            throw std::runtime_error("pipe");
+        for (int fd : ends) {
+            fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) | O_NONBLOCK);
+            fcntl(fd, F_SETFD, FD_CLOEXEC);
+        }
+        resizefd = ends[0];
+        resizewrite = ends[1];
+        signalled = resizewrite;
+
+        struct sigaction action = {};
+        action.sa_handler = on_resize;
+        action.sa_flags = SA_RESTART;
+        sigemptyset(&action.sa_mask);
+        sigaction(SIGWINCH, &action, nullptr);
+#endif
+    }
+
+    EventLoop(const EventLoop &) = delete;
+    EventLoop &operator=(const EventLoop &) = delete;
+
+    ~EventLoop() {
+#if !defined(__linux__)
+        signal(SIGWINCH, SIG_DFL);
+        close(resizewrite);
+#endif
+        close(resizefd);
+        close(wakefds[0]);
+        close(wakefds[1]);
+    }
+
+    // makes wait() return by `when`
+    void wake_at(clock::time_point when) { deadlines.push(when); }
+    void wake_in(clock::duration after) { wake_at(clock::now() + after); }
+
+    // the one call that is safe from any thread: makes wait() return with
+    // `woken` set. calls before the wakeup is seen fold into one.
+    void notify() {
+        const char byte = 0;
+        [[maybe_unused]] auto ignored = write(wakefds[1], &byte, 1);
+    }
+
+    // blocks until there is input, the window changed size, a timer is due
+    // or `until` passes, whichever comes first. nothing spins while idle.
+    happened wait(std::optional<clock::time_point> until = std::nullopt) {
+        happened what;
+        while (true) {
+            std::optional<clock::time_point> next = until;
+            if (!deadlines.empty())
+                next = next ? std::min(*next, deadlines.top()) : deadlines.top();
+
+            int timeout = -1;
+            if (next) {
+                const auto left = std::chrono::ceil<std::chrono::milliseconds>(
+                    *next - clock::now());
+                timeout = static_cast<int>(std::max<long long>(0, left.count()));
+            }
+
+            struct pollfd fds[3] = {{input, POLLIN, 0},
+                                    {resizefd, POLLIN, 0},
+                                    {wakefds[0], POLLIN, 0}};
+            const int ready = poll(fds, 3, timeout);
+            if (ready == -1 && errno != EINTR)
+                throw std::runtime_error("poll");
+
+            if (ready > 0) {
+                what.input = fds[0].revents & (POLLIN | POLLHUP);
+                if (fds[1].revents & POLLIN) {
+                    drain_resizes();
+                    what.resized = true;
+                }
+                if (fds[2].revents & POLLIN) {
+                    drain(wakefds[0]);
+                    what.woken = true;
+                }
+            }
+
+            const auto now = clock::now();
+            while (!deadlines.empty() && deadlines.top() <= now) {
+                deadlines.pop();
+                what.timer = true;
+            }
+            if (what.input || what.resized || what.timer || what.woken ||
+                (until && now >= *until))
+                return what;
+        }
+    }
+};
@@ -1,32 +1,179 @@
 #include "editor.hpp"
+#include "events.hpp"
 #include "extensions.hpp"
+#include "tui.hpp"
+#include "workspace.hpp"
 
-std::string ExtensionHost::buffer() const {
-    std::string context = {};
-    for (int i = 0; i < editor.numlines(); i++) {
-        if (i == editor.numlines() - 1) {
-            context.append(editor.line_at(i).chars);
-        } else {
-            context.append(editor.line_at(i).chars);
-            context.push_back('\n');
+ExtensionHost::ExtensionHost(Workspace &workspace, TUI &ui, EventLoop &loop,
+                             std::unique_ptr<Extension> extension)
+    : workspace(workspace), interface(ui), loop(loop),
+      extension(std::move(extension)),
+      worker([this](std::stop_token stop) { run(stop); }) {}
+
+ExtensionHost::~ExtensionHost() {
+    worker.request_stop();
+    if (worker.joinable())
+        worker.join();
+    extension.reset();
+}
+
+void ExtensionHost::run(std::stop_token stop) {
+    // a worker asleep on `posted`, or in send() on `drained`, has to be
+    // woken to see the stop
+    std::stop_callback wake(stop, [this] {
+        posted.fetch_add(1, std::memory_order_release);
+        posted.notify_one();
+        drained.fetch_add(1, std::memory_order_release);
+        drained.notify_one();
+    });
+
+    extension->on_start(*this);
+    while (!stop.stop_requested()) {
+        // read before draining, so an event posted after the last pop still
+        // changes `posted` and the wait falls through
+        const std::uint32_t seen = posted.load(std::memory_order_acquire);
+        while (auto e = inbox.pop()) {
+            if (stop.stop_requested())
+                break;
+            handling.store(e->buffer, std::memory_order_relaxed);
+            switch (e->what) {
+            case event::kind::key:
+                extension->on_key(e->key, *this);
+                break;
+            case event::kind::edited:
+                extension->on_edit(e->lineid, e->removed, e->added, *this);
+                break;
+            case event::kind::replaced:
+                extension->on_replace(*this);
+                break;
+            }
         }
+        if (stop.stop_requested())
+            break;
+        posted.wait(seen, std::memory_order_acquire);
+    }
+    extension->on_stop(*this);
+}
+
+bool ExtensionHost::post(const event &e) {
+    event tagged = e;
+    tagged.buffer = workspace.current().id;
+    if (!inbox.push(tagged)) {
+        dropped++;
+        return false;
     }
+    posted.fetch_add(1, std::memory_order_release);
+    posted.notify_one();
+    return true;
+}
 
-    return context;
+void ExtensionHost::send(command c) {
+    for (;;) {
+        // read before pushing, so an apply() after a failed push still
+        // changes `drained` and the wait falls through
+        const std::uint32_t seen = drained.load(std::memory_order_acquire);
+        if (outbox.push(std::move(c)))
+            break;
+        if (worker.get_stop_token().stop_requested())
+            return;
+        // the UI thread is behind: nudge it and sleep until it has room
+        loop.notify();
+        drained.wait(seen, std::memory_order_acquire);
+    }
+    loop.notify();
 }
 
-void ExtensionHost::insert_text(std::string_view content) {
-    if (editor.numlines() == 0)
-        editor.insln(0, "");
-    const int last_line = std::max(0, editor.numlines() - 1);
-    editor.point(last_line, editor.line_at(last_line).size());
+bool ExtensionHost::apply() {
+    // inserts in a row into one buffer go in as one edit, one splice and
+    // one undo step, kept apart from what the user typed
+    std::string pending;
+    std::uint64_t into = 0;
+    auto flush = [&] {
+        Buffer *target = workspace.by_id(into);
+        if (!pending.empty() && target) { // a closed buffer's text is dropped
+            Editor &editor = target->editor;
+            editor.checkpoint();
+            const int last = std::max(0, editor.numlines() - 1);
+            const int end =
+                editor.numlines() == 0
+                    ? 0
+                    : static_cast<int>(editor.chars_at(last).size());
+            // the cursor only follows the text if it was waiting at the end
+            // for it, not while the user is busy somewhere else
+            const bool following =
+                editor.pointer_linepos() > last ||
+                (editor.pointer_linepos() == last &&
+                 editor.pointer_charpos() >= end);
+            auto [lineid, charid] = editor.insert_text(last, end, pending);
+            if (following)
+                editor.point(lineid, charid);
+            editor.checkpoint();
+        }
+        pending.clear();
+    };
 
-    for (char c : content) {
-        if (c == '\r')
-            continue;
-        if (c == '\n')
-            editor.insnewln_atptr();
-        else
-            editor.inschar(static_cast<echar>(c));
+    // no more than a ring's worth, so a chatty extension can't keep the UI
+    // thread here forever
+    bool applied = false;
+    for (std::size_t i = 0; i < outbox.capacity(); i++) {
+        auto c = outbox.pop();
+        if (!c)
+            break;
+        applied = true;
+
+        switch (c->what) {
+        case command::kind::insert:
+            if (c->buffer != into) {
+                flush();
+                into = c->buffer;
+            }
+            for (char ch : c->text) {
+                if (ch != '\r')
+                    pending.push_back(ch);
+            }
+            break;
+        case command::kind::statusmsg:
+            flush();
+            interface.set_statusmsg(std::move(c->text));
+            break;
+        }
+    }
+    flush();
+    if (applied) {
+        drained.fetch_add(1, std::memory_order_release);
+        drained.notify_one();
     }
+    return applied;
+}
+
+std::uint64_t ExtensionHost::shown() const {
+    return handling.load(std::memory_order_relaxed);
+}
+
+std::shared_ptr<const Snapshot>
+ExtensionHost::snapshot(std::uint64_t buffer) const {
+    auto hold = workspace.lock();
+    Buffer *which = workspace.by_id(buffer ? buffer : shown());
+    if (!which)
+        return nullptr;
+    return which->editor.snapshot();
+}
+
+std::unique_lock<std::mutex> ExtensionHost::lock() { return workspace.lock(); }
+
+Editor &ExtensionHost::core() { return workspace.current().editor; }
+
+std::string ExtensionHost::buffer() const {
+    auto snap = snapshot();
+    return snap ? snap->text() : std::string();
+}
+
+void ExtensionHost::insert_text(std::string_view content,
+                                std::uint64_t buffer) {
+    send({command::kind::insert, std::string(content),
+          buffer ? buffer : shown()});
+}
+
+void ExtensionHost::set_statusmsg(std::string_view msg) {
+    send({command::kind::statusmsg, std::string(msg)});
 }
@@ -1,30 +1,119 @@
 #pragma once
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <stop_token>
+#include <string>
 #include <string_view>
+#include <thread>
+
+#include "queue.hpp"
 
 class Editor;
+class EventLoop;
+class Extension;
+class Snapshot;
 class TUI;
+class Workspace;
 
+// runs one extension on a thread of its own. keys and edits reach it through
+// one queue, and whatever it wants done comes back through another as
+// commands, which the UI thread applies in batches between frames. a slow
+// extension only falls behind, it never holds up typing.
 class ExtensionHost {
+  public:
+    struct event {
+        enum class kind : std::uint8_t {
+            key,      // `key` was pressed
+            edited,   // `removed` lines at lineid were replaced by `added`
+            replaced, // too much changed to list, e.g. another file opened
+        } what;
+        int key = 0;
+        int lineid = 0;
+        int removed = 0;
+        int added = 0;
+        std::uint64_t buffer = 0; // Buffer::id of the one shown, set by post
+    };
+
+    struct command {
+        enum class kind : std::uint8_t {
+            insert,    // `text` goes at the end of the buffer
+            statusmsg, // `text` goes in the message bar
+        } what;
+        std::string text;
+        std::uint64_t buffer = 0; // Buffer::id an insert is for
+    };
+
   private:
-    Editor &editor;
+    Workspace &workspace;
     TUI &interface;
+    EventLoop &loop;
+    std::unique_ptr<Extension> extension;
+    Queue<event> inbox{INBOX};
+    Queue<command> outbox{OUTBOX};
+    std::atomic<std::uint32_t> posted{0}; // bumped after every event
+    std::atomic<std::uint32_t> drained{0}; // bumped after every apply
+    std::atomic<std::uint64_t> handling{0}; // buffer of the event in hand
+    std::size_t dropped = 0;
+    std::jthread worker;
+
+    static constexpr std::size_t INBOX = 4096;
+    static constexpr std::size_t OUTBOX = 1024;
+
+    void run(std::stop_token stop);
+    void send(command c);
 
   public:
-    ExtensionHost(Editor &editor, TUI &ui) : editor(editor), interface(ui) {}
+    ExtensionHost(Workspace &workspace, TUI &ui, EventLoop &loop,
+                  std::unique_ptr<Extension> extension);
 
-    std::string buffer() const;
+    // stops the worker, which lets the extension stop its own threads in
+    // on_stop while the queues they send through are still here
+    ~ExtensionHost();
+
+    ExtensionHost(const ExtensionHost &) = delete;
+    ExtensionHost &operator=(const ExtensionHost &) = delete;
 
-    void insert_text(std::string_view content);
+    // UI thread. never blocks: if the extension is too far behind the event
+    // is dropped and counted.
+    bool post(const event &e);
+    // UI thread, with the editor lock held. returns whether anything was done.
+    bool apply();
+    std::size_t missed() const { return dropped; }
 
+    // extension thread. the buffer that was shown when the event being
+    // handled was posted; text sent to it later still lands there, even if
+    // another is shown by then. switching buffers is sent as replaced.
+    std::uint64_t shown() const;
+
+    // a snapshot of buffer `buffer` (the shown() one by default), null once
+    // it is closed. it is cheap to take and can be read for as long as
+    // needed; changes_since() on a newer one tells what to re-read.
+    std::shared_ptr<const Snapshot> snapshot(std::uint64_t buffer = 0) const;
+    std::string buffer() const;
+    // appends `content` to buffer `buffer` (the shown() one by default).
+    // dropped if it is closed before the UI thread gets to it.
+    void insert_text(std::string_view content, std::uint64_t buffer = 0);
     void set_statusmsg(std::string_view);
 
-    Editor &core() { return editor; }
-    TUI &ui() { return interface; }
+    // shared with the UI thread, so hold lock() while using it
+    std::unique_lock<std::mutex> lock();
+    Editor &core();
 };
 
+// everything but the constructor and destructor runs on the extension's own
+// thread
 class Extension {
   public:
     virtual ~Extension() = default;
-    virtual void on_start(ExtensionHost &);
+    virtual void on_start(ExtensionHost &) {}
     virtual void on_key(int key, ExtensionHost &) = 0;
+    virtual void on_edit(int /*lineid*/, int /*removed*/, int /*added*/,
+                         ExtensionHost &) {}
+    virtual void on_replace(ExtensionHost &) {}
+    // the host is going away: join any threads still sending it commands.
+    // the last call the extension gets.
+    virtual void on_stop(ExtensionHost &) {}
 };
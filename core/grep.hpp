@@ -0,0 +1,159 @@
+// regex search
+
+#pragma once
+
+#include <optional>
+#include <string_view>
+#include <vector>
+
+#include <re2/re2.h>
+
+#include "editor.hpp"
+#include "pool.hpp"
+
+struct hit {
+    int lineid;
+    int charid;
+    int length;
+};
+
+// regex search over the whole buffer. the lines are cut into chunks that
+// the pool's workers take as they free up, and what they find is put back
+// in line order. matches never span lines. the caller holds the editor lock
+// throughout; workers only read. re2 matches in time linear in the line and
+// without recursion, so a line of megabytes can't blow a worker's stack the
+// way a backtracking engine does.
+class Grep {
+  private:
+    Pool &pool;
+
+    static constexpr int CHUNKLINES = 16384;
+
+    // calls fn(charid, length) for each match in `chars` from `from` on,
+    // until fn returns false
+    template <typename Fn>
+    static bool each_match(const RE2 &re, std::string_view chars, int from,
+                           Fn &&fn) {
+        // starting partway in still lets `^` see it isn't the line start
+        std::size_t at = std::clamp<std::size_t>(from, 0, chars.size());
+        re2::StringPiece m;
+        while (at <= chars.size() &&
+               re.Match(chars, at, chars.size(), RE2::UNANCHORED, &m, 1)) {
+            const std::size_t start = m.data() - chars.data();
+            const int length = static_cast<int>(m.size());
+            if (!fn(static_cast<int>(start), length))
+                return false;
+            at = start + m.size();
+            if (length == 0) {
+                // step over an empty match, a whole character at a time
+                at = at < chars.size() ? utf8::next(chars, at) : at + 1;
+            }
+        }
+        return true;
+    }
+
+    static int chunks_in(int first, int last) {
+        return (last - first + CHUNKLINES - 1) / CHUNKLINES;
+    }
+
+    // first match in lines [first, last), starting at `fromchar` in line
+    // `first`. chunks go out a wave at a time, so a match near the start
+    // doesn't cost a scan of everything after it.
+    std::optional<hit> first_in(Editor &editor, const RE2 &re,
+                                int first, int last, int fromchar) {
+        const int chunks = chunks_in(first, last);
+        const int wave = static_cast<int>(pool.size()) * 2;
+        for (int base = 0; base < chunks; base += wave) {
+            const int count = std::min(wave, chunks - base);
+            std::vector<std::optional<hit>> found(count);
+            pool.for_each(count, [&](std::size_t i) {
+                const int from = first + (base + static_cast<int>(i)) * CHUNKLINES;
+                const int to = std::min(last, from + CHUNKLINES);
+                int lineid = from;
+                editor.visit_lines(from, [&](std::string_view chars) {
+                    each_match(re, chars, lineid == first ? fromchar : 0,
+                               [&](int charid, int length) {
+                                   found[i] = hit{lineid, charid, length};
+                                   return false;
+                               });
+                    return !found[i] && ++lineid < to;
+                });
+            });
+            for (const auto &chunk : found) {
+                if (chunk)
+                    return chunk;
+            }
+        }
+        return std::nullopt;
+    }
+
+  public:
+    explicit Grep(Pool &pool) : pool(pool) {}
+
+    // first match at or after lineid:charid, wrapping around past the end
+    std::optional<hit> next(Editor &editor, const RE2 &re, int lineid,
+                            int charid) {
+        const int lines = editor.numlines();
+        if (lines == 0)
+            return std::nullopt;
+        lineid = std::clamp(lineid, 0, lines - 1);
+        if (auto found = first_in(editor, re, lineid, lines, charid))
+            return found;
+        return first_in(editor, re, 0, lineid + 1, 0);
+    }
+
+    // every match, in order, up to `limit` of them
+    std::vector<hit> find_all(Editor &editor, const RE2 &re,
+                              std::size_t limit = SIZE_MAX) {
+        const int lines = editor.numlines();
+        const int chunks = chunks_in(0, lines);
+        std::vector<std::vector<hit>> found(chunks);
+        pool.for_each(chunks, [&](std::size_t i) {
+            int lineid = static_cast<int>(i) * CHUNKLINES;
+            const int to = std::min(lines, lineid + CHUNKLINES);
+            editor.visit_lines(lineid, [&](std::string_view chars) {
+                each_match(re, chars, 0, [&](int charid, int length) {
+                    found[i].push_back({lineid, charid, length});
+                    return found[i].size() < limit;
+                });
+                return found[i].size() < limit && ++lineid < to;
+            });
+        });
+
+        std::vector<hit> merged;
+        for (auto &chunk : found) {
+            const std::size_t room = limit - merged.size();
+            merged.insert(merged.end(), chunk.begin(),
+                          chunk.begin() + std::min(room, chunk.size()));
+            if (merged.size() == limit)
+                break;
+        }
+        return merged;
+    }
+
+    // how many matches there are. chunks are independent, so this scales
+    // with the number of workers.
+    std::size_t count(Editor &editor, const RE2 &re) {
+        const int lines = editor.numlines();
+        const int chunks = chunks_in(0, lines);
+        std::vector<std::size_t> counts(chunks, 0);
+        pool.for_each(chunks, [&](std::size_t i) {
+            int lineid = static_cast<int>(i) * CHUNKLINES;
+            const int to = std::min(lines, lineid + CHUNKLINES);
+            std::size_t n = 0;
+            editor.visit_lines(lineid, [&](std::string_view chars) {
+                each_match(re, chars, 0, [&](int, int) {
+                    n++;
+                    return true;
+                });
+                return ++lineid < to;
+            });
+            counts[i] = n;
+        });
+
+        std::size_t total = 0;
+        for (std::size_t n : counts)
+            total += n;
+        return total;
+    }
+};
@@ -0,0 +1,434 @@
+// syntax highlighting
+
+#pragma once
+
+#include <algorithm>
+#include <array>
+#include <cctype>
+#include <cstdint>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include "editor.hpp"
+#include "rope.hpp"
+
+enum class colour : std::uint8_t {
+    normal,
+    comment,
+    keyword,
+    type,
+    string,
+    number,
+    preproc,
+};
+
+// escape sequence that switches the terminal to `c`
+inline std::string_view escape(colour c) {
+    switch (c) {
+    case colour::comment:
+        return "\x1b[36m";
+    case colour::keyword:
+        return "\x1b[33m";
+    case colour::type:
+        return "\x1b[32m";
+    case colour::string:
+        return "\x1b[35m";
+    case colour::number:
+        return "\x1b[31m";
+    case colour::preproc:
+        return "\x1b[34m";
+    case colour::normal:
+        break;
+    }
+    return "\x1b[39m";
+}
+
+// `length` render columns drawn in one colour
+struct attrspan {
+    int length;
+    colour paint;
+
+    bool operator==(const attrspan &) const = default;
+};
+
+// where the lexer stands at the end of a line
+enum class lexstate : std::uint8_t {
+    code,
+    comment, // inside /* */
+    string,  // inside a string continued with a trailing backslash
+    preproc, // inside a directive continued with a trailing backslash
+    unknown, // not worked out yet, or the line changed since
+};
+
+namespace lexer {
+
+inline bool ident_start(char c) {
+    return std::isalpha(static_cast<unsigned char>(c)) || c == '_';
+}
+inline bool ident_char(char c) {
+    return std::isalnum(static_cast<unsigned char>(c)) || c == '_';
+}
+
+inline colour classify(std::string_view word) {
+    static const auto sorted = [](auto words) {
+        std::sort(words.begin(), words.end());
+        return words;
+    };
+    static const auto keywords = sorted(std::to_array<std::string_view>({
+        "alignas",   "alignof",      "asm",          "break",
+        "case",      "catch",        "class",        "co_await",
+        "co_return", "co_yield",     "concept",      "const",
+        "consteval", "constexpr",    "constinit",    "const_cast",
+        "continue",  "decltype",     "default",      "delete",
+        "do",        "dynamic_cast", "else",         "enum",
+        "explicit",  "export",       "extern",       "false",
+        "for",       "friend",       "goto",         "if",
+        "inline",    "mutable",      "namespace",    "new",
+        "noexcept",  "nullptr",      "operator",     "private",
+        "protected", "public",       "register",     "reinterpret_cast",
+        "requires",  "return",       "sizeof",       "static",
+        "static_assert", "static_cast", "struct",    "switch",
+        "template",  "this",         "thread_local", "throw",
+        "true",      "try",          "typedef",      "typeid",
+        "typename",  "union",        "using",        "virtual",
+        "volatile",  "while",
+    }));
+    static const auto types = sorted(std::to_array<std::string_view>({
+        "auto",     "bool",     "char",     "char16_t", "char32_t",
+        "char8_t",  "double",   "float",    "int",      "int16_t",
+        "int32_t",  "int64_t",  "int8_t",   "long",     "ptrdiff_t",
+        "short",    "signed",   "size_t",   "ssize_t",  "uint16_t",
+        "uint32_t", "uint64_t", "uint8_t",  "unsigned", "void",
+        "wchar_t",
+    }));
+    if (std::binary_search(keywords.begin(), keywords.end(), word))
+        return colour::keyword;
+    if (std::binary_search(types.begin(), types.end(), word))
+        return colour::type;
+    return colour::normal;
+}
+
+// lexes one line starting in `state` and returns the state it ends in.
+// with `spans` it also colours the line, in render columns, one span per
+// run of a colour.
+inline lexstate lex(std::string_view chars, lexstate state,
+                    std::vector<attrspan> *spans = nullptr) {
+    const std::size_t n = chars.size();
+    std::size_t i = 0;
+    int col = 0;
+    std::size_t counted = 0; // the bytes `col` covers, whole characters
+
+    // colours chars [i, to) and moves past them. characters are split up
+    // the way render_width() splits them, and count with the run they
+    // start in.
+    auto take = [&](std::size_t to, colour paint) {
+        i = to;
+        if (!spans)
+            return;
+        const int start = col;
+        while (counted < to) {
+            const auto c = static_cast<unsigned char>(chars[counted]);
+            if (c == '\t') {
+                col += TAB_SIZE - (col % TAB_SIZE);
+                counted++;
+            } else if (c < 0x80) {
+                col++;
+                counted++;
+            } else {
+                char32_t cp;
+                counted += static_cast<std::size_t>(utf8::decode(
+                    chars.data() + counted, chars.data() + n, cp));
+                col += utf8::width(cp);
+            }
+        }
+        if (col == start)
+            return;
+        if (!spans->empty() && spans->back().paint == paint)
+            spans->back().length += col - start;
+        else
+            spans->push_back({col - start, paint});
+    };
+    const bool continued = n > 0 && chars[n - 1] == '\\';
+
+    // just past the `quote` closing a quoted run from `from`, or past n
+    // when the line ends first
+    auto quoted = [&](std::size_t from, char quote) {
+        while (from < n && chars[from] != quote)
+            from += chars[from] == '\\' ? 2 : 1;
+        return from + 1;
+    };
+
+    if (state == lexstate::preproc) {
+        take(n, colour::preproc);
+        return continued ? lexstate::preproc : lexstate::code;
+    }
+    if (state == lexstate::string) {
+        const std::size_t end = quoted(0, '"');
+        take(std::min(n, end), colour::string);
+        if (end > n)
+            return continued ? lexstate::string : lexstate::code;
+    }
+    if (state == lexstate::comment) {
+        const std::size_t close = chars.find("*/");
+        if (close == std::string_view::npos) {
+            take(n, colour::comment);
+            return lexstate::comment;
+        }
+        take(close + 2, colour::comment);
+    }
+
+    const std::size_t indent = chars.find_first_not_of(" \t");
+    if (i == 0 && indent != std::string_view::npos && chars[indent] == '#') {
+        take(indent, colour::normal);
+        take(n, colour::preproc);
+        return continued ? lexstate::preproc : lexstate::code;
+    }
+
+    while (i < n) {
+        const char c = chars[i];
+        const char next = i + 1 < n ? chars[i + 1] : '\0';
+        if (c == '/' && next == '/') {
+            take(n, colour::comment);
+        } else if (c == '/' && next == '*') {
+            const std::size_t close = chars.find("*/", i + 2);
+            if (close == std::string_view::npos) {
+                take(n, colour::comment);
+                return lexstate::comment;
+            }
+            take(close + 2, colour::comment);
+        } else if (c == '"' || c == '\'') {
+            const std::size_t end = quoted(i + 1, c);
+            take(std::min(n, end), colour::string);
+            if (c == '"' && end > n && continued)
+                return lexstate::string;
+        } else if (std::isdigit(static_cast<unsigned char>(c)) ||
+                   (c == '.' && std::isdigit(static_cast<unsigned char>(next)))) {
+            std::size_t end = i + 1;
+            while (end < n && (ident_char(chars[end]) || chars[end] == '.' ||
+                               chars[end] == '\''))
+                end++;
+            take(end, colour::number);
+        } else if (ident_start(c)) {
+            std::size_t end = i + 1;
+            while (end < n && ident_char(chars[end]))
+                end++;
+            take(end, spans ? classify(chars.substr(i, end - i))
+                            : colour::normal);
+        } else {
+            take(i + 1, colour::normal);
+        }
+    }
+    return lexstate::code;
+}
+
+} // namespace lexer
+
+// walks the colour of a row column by column, left to right
+class colour_walk {
+  private:
+    const std::vector<attrspan> &spans;
+    std::size_t next = 0;
+    std::size_t end = 0;
+    colour now = colour::normal;
+
+  public:
+    explicit colour_walk(const std::vector<attrspan> &spans) : spans(spans) {}
+
+    colour at(std::size_t col) {
+        while (col >= end) {
+            if (next == spans.size()) {
+                now = colour::normal;
+                end = SIZE_MAX;
+                break;
+            }
+            now = spans[next].paint;
+            end += static_cast<std::size_t>(spans[next++].length);
+        }
+        return now;
+    }
+};
+
+// the part of `spans` covering columns [from, from + width)
+inline void slice_spans(const std::vector<attrspan> &spans, int from,
+                        int width, std::vector<attrspan> &out) {
+    out.clear();
+    int col = 0;
+    for (const attrspan &span : spans) {
+        const int first = std::max(col, from);
+        const int last = std::min(col + span.length, from + width);
+        if (first < last)
+            out.push_back({last - first, span.paint});
+        col += span.length;
+        if (col >= from + width)
+            break;
+    }
+}
+
+struct statesum {
+    int lines;
+    int unknown;
+
+    statesum operator+(const statesum &other) const {
+        return {lines + other.lines, unknown + other.unknown};
+    }
+};
+
+struct staterun {
+    int lines;
+    lexstate end; // state each of these lines ends in
+};
+
+struct state_measure {
+    statesum operator()(const staterun &run) const {
+        return {run.lines, run.end == lexstate::unknown ? run.lines : 0};
+    }
+};
+
+// colours C and C++ buffers. the state each line ends in is kept for the
+// lines lexed so far, run-length packed like the wrap index, so a line's
+// colours only need the line above it. an edit marks the lines it touched
+// unknown; they get re-lexed on the next draw, carrying on down only while
+// the end states keep coming out different. typing costs the lines it
+// changed, not the file.
+class Highlighter {
+  private:
+    Rope<staterun, state_measure> ends; // lines [0, lexed)
+    long synced = -1;
+    bool active = false;
+    std::string name;
+
+    int lexed() { return ends.total().lines; }
+
+    // makes sure a run starts exactly at `lineid` and returns its position
+    std::size_t cut(int lineid) {
+        auto [at, before] =
+            ends.search([&](const statesum &sum) { return sum.lines > lineid; });
+        if (at >= ends.size() || before.lines == lineid)
+            return at;
+
+        staterun &run = ends.at(at);
+        const int head = lineid - before.lines;
+        const staterun tail{run.lines - head, run.end};
+        run.lines = head;
+        ends.remeasure(at);
+        ends.insert(at + 1, tail);
+        return at + 1;
+    }
+
+    lexstate end_of(int lineid) {
+        auto [at, before] =
+            ends.search([&](const statesum &sum) { return sum.lines > lineid; });
+        return ends.at(at).end;
+    }
+
+    void set(int lineid, lexstate state) {
+        const std::size_t at = cut(lineid);
+        cut(lineid + 1);
+        ends.at(at).end = state;
+        ends.remeasure(at);
+    }
+
+    void append(lexstate state) {
+        if (!ends.empty()) {
+            staterun &last = ends.at(ends.size() - 1);
+            if (last.end == state) {
+                last.lines++;
+                ends.remeasure(ends.size() - 1);
+                return;
+            }
+        }
+        ends.push_back({1, state});
+    }
+
+    // the first line whose end state isn't known, or lexed() if none
+    int first_unknown() {
+        auto [at, before] = ends.search(
+            [](const statesum &sum) { return sum.unknown > 0; });
+        return before.lines;
+    }
+
+    // re-lexes from `lineid` while the end states differ from the ones kept
+    void relex(Editor &editor, int lineid) {
+        lexstate state = lineid > 0 ? end_of(lineid - 1) : lexstate::code;
+        const int known = lexed();
+        editor.visit_lines(lineid, [&](std::string_view chars) {
+            const lexstate now = lexer::lex(chars, state);
+            if (end_of(lineid) == now)
+                return false;
+            set(lineid, now);
+            state = now;
+            return ++lineid < known;
+        });
+    }
+
+    // makes the end states of lines [0, upto) good
+    void ensure(Editor &editor, int upto) {
+        for (int u; (u = first_unknown()) < std::min(upto, lexed());)
+            relex(editor, u);
+
+        if (lexed() >= upto)
+            return;
+        int lineid = lexed();
+        lexstate state = lineid > 0 ? end_of(lineid - 1) : lexstate::code;
+        editor.visit_lines(lineid, [&](std::string_view chars) {
+            state = lexer::lex(chars, state);
+            append(state);
+            return ++lineid < upto;
+        });
+    }
+
+  public:
+    explicit Highlighter(std::shared_ptr<Slabs> slabs = Slabs::fallback())
+        : ends(std::move(slabs)) {}
+
+    static bool handles(std::string_view filename) {
+        static constexpr std::array<std::string_view, 8> suffixes = {
+            ".c", ".h", ".cc", ".cpp", ".cxx", ".hh", ".hpp", ".hxx"};
+        return std::any_of(suffixes.begin(), suffixes.end(), [&](auto s) {
+            return filename.ends_with(s);
+        });
+    }
+
+    // follows the edits made since the last call
+    void sync(Editor &editor) {
+        if (editor.fileName != name) {
+            name = editor.fileName;
+            active = handles(name);
+            ends.clear();
+            synced = -1;
+        }
+        auto edits = editor.edits_since(synced);
+        synced = editor.version();
+        if (!active)
+            return;
+        if (!edits) {
+            ends.clear();
+            return;
+        }
+
+        for (const edit &e : *edits) {
+            const int known = lexed();
+            if (e.lineid >= known)
+                continue;
+            const int removed = std::min(e.removed, known - e.lineid);
+            if (removed > 0) {
+                const std::size_t first = cut(e.lineid);
+                ends.erase(first, cut(e.lineid + removed));
+            }
+            if (e.added > 0)
+                ends.insert(cut(e.lineid), {e.added, lexstate::unknown});
+        }
+    }
+
+    // colours of line `lineid`, in render columns
+    void colour_line(Editor &editor, int lineid, std::vector<attrspan> &spans) {
+        spans.clear();
+        if (!active)
+            return;
+        ensure(editor, lineid);
+        const lexstate start =
+            lineid > 0 ? end_of(lineid - 1) : lexstate::code;
+        lexer::lex(editor.chars_at(lineid), start, &spans);
+    }
+};
@@ -0,0 +1,283 @@
+// undo history
+
+#pragma once
+
+#include <algorithm>
+#include <cctype>
+#include <cstddef>
+#include <cstdint>
+#include <optional>
+#include <span>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include "utf8.hpp"
+
+// what was done to the buffer, as ranges rather than copies of lines. the
+// text of every change lives back to back in one arena, changes are grouped
+// so an undo takes back a whole word or a whole paste at once, and the
+// oldest groups are dropped once the log outgrows its budget.
+class History {
+  public:
+    enum class kind : std::uint8_t {
+        inserted,      // text went in at lineid:charid
+        erased,        // text starting at lineid:charid went away
+        lines_added,   // whole lines went in before lineid
+        lines_removed, // whole lines starting at lineid went away
+    };
+
+    struct change {
+        kind what;
+        bool joined;   // undone together with the change before it
+        bool backward; // text is stored back to front
+        int lineid;
+        int charid;
+        std::size_t offset; // text in the arena
+        std::size_t length;
+    };
+
+  private:
+    std::vector<change> changes;
+    std::size_t applied = 0; // changes[applied..] were undone and can be redone
+    std::string arena;
+    std::size_t limit;
+    bool sealed = true; // the next change starts a group of its own
+    bool joining = false;
+
+    static constexpr std::size_t DEFAULTLIMIT = 64 << 20;
+
+    std::size_t footprint() const {
+        return arena.size() + changes.size() * sizeof(change);
+    }
+
+    static bool space(char32_t cp) {
+        if (cp < 0x80)
+            return std::isspace(static_cast<int>(cp));
+        return cp == 0x85 || cp == 0xa0 || cp == 0x1680 ||
+               (cp >= 0x2000 && cp <= 0x200a) || cp == 0x2028 ||
+               cp == 0x2029 || cp == 0x202f || cp == 0x205f || cp == 0x3000;
+    }
+
+    // a typed word and the spaces after it make one group
+    static bool breaks_word(char32_t before, char32_t next) {
+        return space(before) && !space(next);
+    }
+
+    // the code point `text` encodes, if it is exactly one character
+    static std::optional<char32_t> one(std::string_view text) {
+        if (text.empty())
+            return std::nullopt;
+        char32_t cp;
+        const char *end = text.data() + text.size();
+        if (utf8::decode(text.data(), end, cp) !=
+            static_cast<int>(text.size()))
+            return std::nullopt;
+        return cp;
+    }
+
+    // the character the last change took in most recently
+    char32_t newest() const {
+        const change &last = changes.back();
+        const std::size_t n = std::min<std::size_t>(4, last.length);
+        std::string tail(arena, last.offset + last.length - n, n);
+        std::size_t at = 0;
+        if (last.backward)
+            std::reverse(tail.begin(), tail.end()); // it starts on the lead
+        else
+            at = utf8::previous(tail, tail.size());
+        char32_t cp;
+        utf8::decode(tail.data() + at, tail.data() + tail.size(), cp);
+        return cp;
+    }
+
+    // whether a one character change of `bytes` bytes can be folded into
+    // the last one
+    bool extends(kind what, int lineid, int charid, char32_t c,
+                 std::size_t bytes) const {
+        if (sealed || applied == 0 || applied != changes.size())
+            return false;
+        const change &last = changes.back();
+        if (last.what != what || last.lineid != lineid || last.length == 0 ||
+            c == '\n')
+            return false;
+        const char32_t previous = newest();
+        if (what == kind::inserted)
+            return last.charid + static_cast<int>(last.length) == charid &&
+                   !breaks_word(previous, c);
+        // backspacing: each character sits just before the last one
+        return last.backward &&
+               last.charid == charid + static_cast<int>(bytes) &&
+               !breaks_word(c, previous);
+    }
+
+    // drops the oldest groups until the log is back under budget
+    void trim() {
+        if (footprint() <= limit)
+            return;
+        std::size_t drop = 0;
+        while (drop < applied && footprint() - dropped_bytes(drop) > limit * 3 / 4) {
+            drop++;
+            while (drop < applied && changes[drop].joined)
+                drop++;
+        }
+        if (drop == 0) {
+            // nothing done is left to drop, only redo history
+            changes.resize(applied);
+            arena.resize(applied ? changes.back().offset + changes.back().length
+                                 : 0);
+            return;
+        }
+
+        const std::size_t base =
+            drop < changes.size() ? changes[drop].offset : arena.size();
+        arena.erase(0, base);
+        changes.erase(changes.begin(), changes.begin() + drop);
+        for (change &c : changes)
+            c.offset -= base;
+        applied -= drop;
+        if (!changes.empty())
+            changes.front().joined = false;
+    }
+
+    std::size_t dropped_bytes(std::size_t drop) const {
+        const std::size_t base =
+            drop < changes.size() ? changes[drop].offset : arena.size();
+        return base + drop * sizeof(change);
+    }
+
+    void add(kind what, int lineid, int charid, std::string_view text,
+             bool backward) {
+        // anything undone is gone for good once something new happens
+        if (applied < changes.size()) {
+            changes.resize(applied);
+            arena.resize(applied ? changes.back().offset + changes.back().length
+                                 : 0);
+        }
+        if (text.size() > limit) {
+            // too big to ever fit, and what came before it can't be undone
+            // past it either
+            clear();
+            return;
+        }
+
+        changes.push_back({what, joining && !changes.empty(), backward,
+                           lineid, charid, arena.size(), text.size()});
+        arena.append(text);
+        applied = changes.size();
+        joining = false;
+        sealed = what != kind::inserted && what != kind::erased;
+        trim();
+    }
+
+  public:
+    explicit History(std::size_t limit = DEFAULTLIMIT) : limit(limit) {}
+
+    void set_limit(std::size_t bytes) {
+        limit = bytes;
+        trim();
+    }
+
+    void clear() {
+        changes.clear();
+        arena.clear();
+        applied = 0;
+        sealed = true;
+        joining = false;
+    }
+
+    // what the history holds on to, counting spare capacity
+    std::size_t bytes() const {
+        return arena.capacity() + changes.capacity() * sizeof(change);
+    }
+
+    // the next change starts a new group, e.g. after the cursor moved
+    void seal() { sealed = true; }
+    // the next change belongs to the same group as the last one
+    void join() { joining = true; }
+
+    void inserted(int lineid, int charid, std::string_view text) {
+        const auto c = one(text);
+        if (c && extends(kind::inserted, lineid, charid, *c, text.size())) {
+            changes.back().length += text.size();
+            arena.append(text);
+            trim();
+            return;
+        }
+        add(kind::inserted, lineid, charid, text, false);
+        sealed = text.find('\n') != std::string_view::npos;
+    }
+
+    // a character backspaced over is kept with its bytes reversed, so the
+    // whole run reads in buffer order once text() turns it round
+    void erased(int lineid, int charid, std::string_view text,
+                bool backward = false) {
+        const auto c = backward ? one(text) : std::nullopt;
+        if (!c) {
+            add(kind::erased, lineid, charid, text, false);
+            sealed = text.find('\n') != std::string_view::npos;
+            return;
+        }
+        const std::string reversed(text.rbegin(), text.rend());
+        if (extends(kind::erased, lineid, charid, *c, text.size())) {
+            changes.back().length += text.size();
+            changes.back().charid -= static_cast<int>(text.size());
+            arena.append(reversed);
+            trim();
+            return;
+        }
+        add(kind::erased, lineid, charid, reversed, true);
+        sealed = *c == '\n';
+    }
+
+    // `text` is the lines joined with '\n'
+    void lines_added(int lineid, std::string_view text) {
+        add(kind::lines_added, lineid, 0, text, false);
+    }
+    void lines_removed(int lineid, std::string_view text) {
+        add(kind::lines_removed, lineid, 0, text, false);
+    }
+
+    // text of `c`, in buffer order
+    std::string text(const change &c) const {
+        std::string out(arena, c.offset, c.length);
+        if (c.backward)
+            std::reverse(out.begin(), out.end());
+        return out;
+    }
+
+    bool can_undo() const { return applied > 0; }
+    bool can_redo() const { return applied < changes.size(); }
+
+    // the group to take back, oldest first. the caller reverts it newest
+    // first.
+    std::span<const change> undo() {
+        if (!can_undo())
+            return {};
+        std::size_t first = applied - 1;
+        while (first > 0 && changes[first].joined)
+            first--;
+        std::span<const change> group(changes.data() + first, applied - first);
+        applied = first;
+        sealed = true;
+        return group;
+    }
+
+    // the group to do again, oldest first
+    std::span<const change> redo() {
+        if (!can_redo())
+            return {};
+        std::size_t last = applied + 1;
+        while (last < changes.size() && changes[last].joined)
+            last++;
+        std::span<const change> group(changes.data() + applied, last - applied);
+        applied = last;
+        sealed = true;
+        return group;
+    }
+
+    // bytes held by the log
+    std::size_t memory() const {
+        return arena.capacity() + changes.capacity() * sizeof(change);
+    }
+};
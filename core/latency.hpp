@@ -0,0 +1,172 @@
+// latency
+
+#pragma once
+
+#include <algorithm>
+#include <array>
+#include <bit>
+#include <chrono>
+#include <cmath>
+#include <cstdint>
+#include <cstdio>
+#include <fstream>
+#include <string>
+
+// counts durations in log-linear buckets the way HdrHistogram does: exact
+// below 32 ns, then 16 buckets per power of two, so any value is known to
+// within about 6% for a few kilobytes and a shift and an add per record.
+class Histogram {
+  private:
+    static constexpr int SUBBITS = 4;
+    static constexpr std::uint64_t SUB = 1 << SUBBITS;
+
+    std::array<std::uint64_t, 64 * SUB> counts{};
+    std::uint64_t total = 0;
+    std::uint64_t sum = 0;
+    std::uint64_t largest = 0;
+
+    static std::size_t bucket(std::uint64_t ns) {
+        if (ns < 2 * SUB)
+            return static_cast<std::size_t>(ns);
+        const int shift = std::bit_width(ns) - (SUBBITS + 1);
+        return static_cast<std::size_t>(shift * SUB + (ns >> shift));
+    }
+
+    // the highest value that lands in bucket `b`
+    static std::uint64_t highest(std::size_t b) {
+        if (b < 2 * SUB)
+            return b;
+        const std::size_t shift = b / SUB - 1;
+        const std::uint64_t top = b - shift * SUB;
+        return ((top + 1) << shift) - 1;
+    }
+
+  public:
+    void record(std::uint64_t ns) {
+        counts[bucket(ns)]++;
+        total++;
+        sum += ns;
+        largest = std::max(largest, ns);
+    }
+
+    std::uint64_t count() const { return total; }
+    std::uint64_t max() const { return largest; }
+    double mean() const {
+        return total == 0 ? 0 : static_cast<double>(sum) /
+                                    static_cast<double>(total);
+    }
+
+    // the value `p` percent (0 to 100) of records are at or below
+    std::uint64_t percentile(double p) const {
+        if (total == 0)
+            return 0;
+        const auto rank = std::max<std::uint64_t>(
+            1, static_cast<std::uint64_t>(
+                   std::ceil(p / 100 * static_cast<double>(total))));
+        std::uint64_t seen = 0;
+        for (std::size_t b = 0; b < counts.size(); b++) {
+            seen += counts[b];
+            if (seen >= rank)
+                return std::min(highest(b), largest);
+        }
+        return largest;
+    }
+};
+
+// where the time between a key arriving and its frame going out is spent.
+// nothing is recorded unless `on`, and while off every probe costs one
+// well predicted branch.
+class Latency {
+  public:
+    using clock = std::chrono::steady_clock;
+
+    enum stage {
+        input,   // key arrived to its action picked by process_key
+        perform, // Action::perform
+        index,   // TUI::update_index
+        rows,    // TUI::draw_rows
+        flush,   // the frame written to the terminal
+        STAGES,
+    };
+    static constexpr const char *names[STAGES] = {"input", "perform", "index",
+                                                  "rows", "flush"};
+
+    bool on = false;
+
+    // times the scope it lives in, if recording was on when it started
+    class span {
+      private:
+        Latency *into;
+        stage what;
+        clock::time_point start;
+
+      public:
+        span(Latency &latency, stage what)
+            : into(latency.on ? &latency : nullptr), what(what) {
+            if (into) [[unlikely]]
+                start = clock::now();
+        }
+        span(const span &) = delete;
+        span &operator=(const span &) = delete;
+        ~span() {
+            if (into) [[unlikely]]
+                into->record(what, clock::now() - start);
+        }
+    };
+
+    void record(stage what, clock::duration took) {
+        of[what].record(static_cast<std::uint64_t>(
+            std::chrono::duration_cast<std::chrono::nanoseconds>(took)
+                .count()));
+    }
+
+    const Histogram &operator[](stage what) const { return of[what]; }
+
+    // p50/p99 of each stage in microseconds, to fit the message bar
+    std::string overlay() const {
+        std::string text = "p50/p99 us";
+        for (int s = 0; s < STAGES; s++) {
+            char part[64];
+            std::snprintf(part, sizeof(part), "  %s %s/%s", names[s],
+                          micros(of[s].percentile(50)).c_str(),
+                          micros(of[s].percentile(99)).c_str());
+            text += part;
+        }
+        return text;
+    }
+
+    // a table of every stage, false if `path` can't be written
+    bool dump(const std::string &path) const {
+        std::ofstream out(path, std::ios::trunc);
+        if (!out)
+            return false;
+        out << "# microseconds\n";
+        char line[160];
+        std::snprintf(line, sizeof(line),
+                      "%-8s %10s %10s %10s %10s %10s %10s %10s\n", "stage",
+                      "count", "mean", "p50", "p90", "p99", "p99.9", "max");
+        out << line;
+        for (int s = 0; s < STAGES; s++) {
+            const Histogram &h = of[s];
+            std::snprintf(line, sizeof(line),
+                          "%-8s %10llu %10.1f %10.1f %10.1f %10.1f %10.1f "
+                          "%10.1f\n",
+                          names[s], static_cast<unsigned long long>(h.count()),
+                          h.mean() / 1e3, h.percentile(50) / 1e3,
+                          h.percentile(90) / 1e3, h.percentile(99) / 1e3,
+                          h.percentile(99.9) / 1e3, h.max() / 1e3);
+            out << line;
+        }
+        return static_cast<bool>(out);
+    }
+
+  private:
+    Histogram of[STAGES];
+
+    static std::string micros(std::uint64_t ns) {
+        char text[32];
+        std::snprintf(text, sizeof(text), ns < 10000 ? "%.1f" : "%.0f",
+                      static_cast<double>(ns) / 1e3);
+        return text;
+    }
+};
@@ -0,0 +1,90 @@
+// background file loading
+
+#pragma once
+
+#include <atomic>
+#include <memory>
+#include <stop_token>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "editor.hpp"
+
+// streams a mapped file's lines into an Editor from a worker thread. the
+// worker only holds the editor lock long enough to append each chunk, so the
+// UI can draw and scroll whatever has arrived so far.
+class Loader {
+  private:
+    std::atomic<bool> running{false};
+    std::atomic<bool> working{false}; // the worker hasn't returned yet
+    std::atomic<std::size_t> done{0};
+    std::size_t total = 0;
+    std::jthread worker; // last, so it is joined before the rest goes away
+
+  public:
+    // opens `filepath` into `editor`. small files are read on the spot,
+    // big ones come in the background. the caller holds the editor lock, so
+    // a load still running into the same editor has to be idle() first.
+    void start(Editor &editor, const std::string &filepath) {
+        cancel();
+        if (worker.joinable())
+            worker.join();
+
+        const fs::path path(filepath);
+        if (!fs::exists(path))
+            throw std::runtime_error("file not found: " + filepath);
+        if (!fs::is_regular_file(path) ||
+            fs::file_size(path) < Editor::MAPTHRESHOLD) {
+            editor.open(filepath, openmode::compact);
+            return;
+        }
+
+        auto file = std::make_shared<MappedFile>(path.string(), true);
+        total = file->size();
+        done = 0;
+        editor.adopt(file, fs::canonical(path).string());
+
+        running = true;
+        working = true;
+        worker = std::jthread([this, &editor, file](std::stop_token stop) {
+            std::vector<std::size_t> found;
+            std::size_t at = 0;
+            while (!stop.stop_requested() && !file->indexed()) {
+                found.clear();
+                const std::size_t upto =
+                    file->scan(at, MappedFile::CHUNK, found);
+
+                auto hold = editor.lock();
+                if (stop.stop_requested())
+                    break;
+                const int known = file->lines();
+                file->extend(found, upto);
+                editor.extend(known, file->lines() - known);
+                at = upto;
+                done.store(upto, std::memory_order_relaxed);
+            }
+            running = false;
+            working = false;
+        });
+    }
+
+    bool loading() const { return running; }
+    // whether the worker is gone, cancelled or not. until then it may be
+    // waiting on the editor lock to see that it was.
+    bool idle() const { return !working; }
+
+    int percent() const {
+        if (total == 0)
+            return 100;
+        return static_cast<int>(done.load(std::memory_order_relaxed) * 100 /
+                                total);
+    }
+
+    // asks the worker to stop. it never blocks, so it is safe to call while
+    // holding the editor lock.
+    void cancel() {
+        worker.request_stop();
+        running = false;
+    }
+};
@@ -1,18 +1,99 @@
+#include <cstdio>
+#include <cstring>
+#include <optional>
+#include <vector>
+#include <unistd.h>
+
+#include "ai.hpp"
+#include "trace.hpp"
 #include "tui.hpp"
 
+namespace {
+
+// runs a recorded session through a headless ui as fast as it goes and
+// reports how long each keystroke took. the file is edited as a copy in a
+// scratch directory, so saves in the trace land there.
+int replay(const std::string &trace, const char *file,
+           const std::optional<std::string> &timings) {
+    const auto records = trace::load(trace);
+    thing size = {80, 24};
+    if (!records.empty() && records.front().keys.empty())
+        size = records.front().size;
+
+    const fs::path scratch =
+        fs::temp_directory_path() / ("replay-" + std::to_string(getpid()));
+    const fs::path home = fs::current_path();
+    fs::create_directories(scratch);
+    Workspace workspace;
+    if (file) {
+        const fs::path copy = scratch / fs::path(file).filename();
+        fs::copy_file(file, copy);
+        workspace.current().editor.open(copy.string());
+    }
+    fs::current_path(scratch);
+
+    auto headless = std::make_shared<HeadlessBackend>(size);
+    trace::result result;
+    {
+        TUI ui(workspace, Terminal(headless));
+        if (timings)
+            ui.dump_latency_to(fs::absolute(home / *timings).string());
+        auto hold = workspace.lock();
+        result = trace::replay(records, ui, *headless);
+        ui.dump_latency();
+    }
+    fs::current_path(home);
+    fs::remove_all(scratch);
+
+    std::printf("%s\n", result.summary().c_str());
+    return 0;
+}
+
+} // namespace
+
 int main(int argc, char *argv[]) {
-    Editor editor;
-    Terminal terminal;
-    TUI ui(editor, terminal);
+    // main [--record TRACE | --replay TRACE] [--latency FILE] [file...]
+    std::optional<std::string> record, replaying, timings;
+    std::vector<const char *> files;
+    for (int i = 1; i < argc; i++) {
+        if (std::strcmp(argv[i], "--record") == 0 && i + 1 < argc)
+            record = argv[++i];
+        else if (std::strcmp(argv[i], "--replay") == 0 && i + 1 < argc)
+            replaying = argv[++i];
+        else if (std::strcmp(argv[i], "--latency") == 0 && i + 1 < argc)
+            timings = argv[++i];
+        else
+            files.push_back(argv[i]);
+    }
+    if (replaying)
+        return replay(*replaying, files.empty() ? nullptr : files.front(),
+                      timings);
+
+    std::shared_ptr<Backend> tty = std::make_shared<TtyBackend>();
+    if (record)
+        tty = std::make_shared<trace::Recorder>(tty, *record);
+
+    Workspace workspace;
+    Terminal terminal(tty);
+    TUI ui(workspace, terminal);
+    ui.register_extension(std::make_unique<AI>());
+    if (timings)
+        ui.dump_latency_to(*timings);
 
-    if (argc >= 2) {
-        fs::path file(argv[1]);
-        editor.open(file);
+    {
+        // each file gets a buffer, the first one shown
+        auto hold = workspace.lock();
+        for (const char *file : files)
+            ui.load(file);
+        if (workspace.size() > 1)
+            ui.show(0);
     }
 
     while (true) {
-        ui.draw_screen();
-        ui.receive_input();
+        // sleep without the lock, so a background load can keep appending
+        auto what = ui.await_events();
+        auto hold = workspace.lock();
+        ui.handle(what);
     }
 
     return 0;
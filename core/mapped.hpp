@@ -0,0 +1,160 @@
+// memory mapped files
+
+#pragma once
+
+#include <algorithm>
+#include <cstring>
+#include <fcntl.h>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <vector>
+
+#include "scan.hpp"
+
+// a read-only view of a file plus the byte offset of each of its lines.
+// nothing is copied out of the mapping until someone asks for a line. the
+// text can also be a block held in memory, laid out and read the same way.
+class MappedFile {
+  private:
+    const char *data = nullptr;
+    std::size_t length = 0;
+    std::string held; // the block, when not mapped
+    // start of every line, then one past the end of the last terminator
+    // seen, so line i always ends at starts[i + 1] - 1
+    std::vector<std::size_t> starts{0};
+    std::size_t scanned = 0;
+    bool complete = false;
+
+  public:
+    static constexpr std::size_t CHUNK = 4 << 20;
+
+    // `deferred` leaves the line offsets to be filled in with scan/extend,
+    // e.g. from a loader thread
+    explicit MappedFile(const std::string &path, bool deferred = false) {
+        const int fd = ::open(path.c_str(), O_RDONLY);
+        if (fd == -1)
+            throw std::runtime_error("failed to open: " + path);
+
+        struct stat st;
+        if (fstat(fd, &st) == -1) {
+            close(fd);
+            throw std::runtime_error("failed to stat: " + path);
+        }
+
+        length = static_cast<std::size_t>(st.st_size);
+        if (length > 0) {
+            void *addr = mmap(nullptr, length, PROT_READ, MAP_PRIVATE, fd, 0);
+            close(fd);
+            if (addr == MAP_FAILED)
+                throw std::runtime_error("failed to map: " + path);
+            data = static_cast<const char *>(addr);
+        } else {
+            close(fd);
+        }
+
+        if (!deferred)
+            index();
+    }
+
+    // says the string passed along is the text itself rather than a path
+    struct text_t {};
+    static constexpr text_t text{};
+
+    // `contents` kept in memory and indexed on the spot, lines ending at
+    // "\n" or "\r\n" as in a file
+    MappedFile(text_t, std::string contents) : held(std::move(contents)) {
+        length = held.size();
+        if (length > 0)
+            data = held.data();
+        index();
+        starts.shrink_to_fit(); // it won't grow again
+    }
+
+    MappedFile(const MappedFile &) = delete;
+    MappedFile &operator=(const MappedFile &) = delete;
+
+    ~MappedFile() {
+        if (data && held.empty())
+            munmap(const_cast<char *>(data), length);
+    }
+
+    std::size_t size() const { return length; }
+    std::size_t progress() const { return scanned; }
+    bool indexed() const { return complete; }
+
+    // whether the text is in memory of its own rather than paged in
+    bool resident() const { return !held.empty(); }
+
+    std::size_t table_bytes() const {
+        return starts.capacity() * sizeof(std::size_t);
+    }
+
+    // the whole table at once
+    void index() {
+        std::vector<std::size_t> found;
+        while (!indexed()) {
+            found.clear();
+            extend(found, scan(scanned, length, found));
+        }
+    }
+
+    // lines whose end has been found so far
+    int lines() const { return static_cast<int>(starts.size() - 1); }
+
+    // looks for line starts in up to `budget` bytes from `from` without
+    // touching the table, so it is safe to run while others read lines.
+    // returns where the scan stopped.
+    std::size_t scan(std::size_t from, std::size_t budget,
+                     std::vector<std::size_t> &found) const {
+        const std::size_t stop = std::min(length, from + budget);
+        while (from < stop) {
+            const char *nl = scan::find(data + from, data + stop, '\n');
+            if (nl == data + stop)
+                return stop;
+            from = static_cast<std::size_t>(nl - data) + 1;
+            found.push_back(from);
+        }
+        return from;
+    }
+
+    // adds what scan() found to the table
+    void extend(const std::vector<std::size_t> &found, std::size_t upto) {
+        starts.insert(starts.end(), found.begin(), found.end());
+        scanned = upto;
+        if (scanned >= length && !complete) {
+            complete = true;
+            if (starts.back() < length)
+                starts.push_back(length + 1); // last line has no terminator
+        }
+    }
+
+    // byte offset line `which` starts at
+    std::size_t start_of(std::size_t which) const { return starts[which]; }
+
+    // line holding byte `offset`
+    std::size_t line_of(std::size_t offset) const {
+        return static_cast<std::size_t>(
+            std::upper_bound(starts.begin(), starts.end(), offset) -
+            starts.begin() - 1);
+    }
+
+    // raw bytes of lines [first, first + count), terminators included
+    std::string_view span(std::size_t first, std::size_t count) const {
+        const std::size_t begin = starts[first];
+        const std::size_t end = std::min(starts[first + count], length);
+        return {data + begin, end - begin};
+    }
+
+    // contents of line `which`, without its '\n' or "\r\n"
+    std::string_view line(std::size_t which) const {
+        const std::size_t begin = starts[which];
+        std::size_t end = starts[which + 1] - 1;
+        if (end > begin && data[end - 1] == '\r')
+            end--;
+        return {data + begin, end - begin};
+    }
+};
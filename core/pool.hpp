@@ -0,0 +1,79 @@
+// thread pool
+
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <latch>
+#include <mutex>
+#include <stop_token>
+#include <thread>
+#include <vector>
+
+// a fixed set of workers that jobs get handed to. for work that splits into
+// pieces use for_each(), which blocks until every piece is done.
+class Pool {
+  private:
+    std::mutex guard;
+    std::condition_variable_any wake;
+    std::deque<std::function<void()>> jobs;
+    std::vector<std::jthread> workers; // last, so they are joined first
+
+    void work(std::stop_token stop) {
+        while (true) {
+            std::function<void()> job;
+            {
+                std::unique_lock<std::mutex> hold(guard);
+                if (!wake.wait(hold, stop, [&] { return !jobs.empty(); }))
+                    return;
+                job = std::move(jobs.front());
+                jobs.pop_front();
+            }
+            job();
+        }
+    }
+
+  public:
+    explicit Pool(unsigned threads = std::thread::hardware_concurrency()) {
+        threads = std::max(1u, threads);
+        workers.reserve(threads);
+        for (unsigned i = 0; i < threads; i++)
+            workers.emplace_back([this](std::stop_token stop) { work(stop); });
+    }
+
+    Pool(const Pool &) = delete;
+    Pool &operator=(const Pool &) = delete;
+
+    unsigned size() const { return static_cast<unsigned>(workers.size()); }
+
+    void submit(std::function<void()> job) {
+        {
+            std::lock_guard<std::mutex> hold(guard);
+            jobs.push_back(std::move(job));
+        }
+        wake.notify_one();
+    }
+
+    // runs fn(0) .. fn(count - 1) across the workers and waits for all of
+    // them. each worker pulls the next index as it frees up, so uneven
+    // pieces still balance out.
+    template <typename Fn> void for_each(std::size_t count, Fn &&fn) {
+        if (count == 0)
+            return;
+        std::atomic<std::size_t> next{0};
+        const unsigned helpers =
+            static_cast<unsigned>(std::min<std::size_t>(size(), count));
+        std::latch finished(helpers);
+        for (unsigned i = 0; i < helpers; i++) {
+            submit([&] {
+                for (std::size_t at; (at = next.fetch_add(1)) < count;)
+                    fn(at);
+                finished.count_down();
+            });
+        }
+        finished.wait();
+    }
+};
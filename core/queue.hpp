@@ -0,0 +1,77 @@
+// lock-free queue
+
+#pragma once
+
+#include <atomic>
+#include <cstddef>
+#include <memory>
+#include <optional>
+#include <utility>
+
+// a bounded ring for exactly one producer thread and one consumer thread.
+// neither side ever takes a lock or waits on the other: push() fails when
+// the ring is full and pop() comes back empty when there is nothing in it,
+// and the caller decides what to do about that.
+template <typename T> class Queue {
+  private:
+    static constexpr std::size_t LINE = 64; // cache line
+
+    std::size_t mask;
+    std::unique_ptr<T[]> slots;
+
+    // the two ends sit on their own cache lines, so the threads don't keep
+    // stealing each other's line. each end also remembers where it last saw
+    // the other one, and only reloads it when that isn't enough.
+    alignas(LINE) std::atomic<std::size_t> head{0}; // next to pop
+    std::size_t tailseen = 0;
+    alignas(LINE) std::atomic<std::size_t> tail{0}; // next to push
+    std::size_t headseen = 0;
+
+  public:
+    // room for `capacity` items, rounded up to a power of two
+    explicit Queue(std::size_t capacity = 1024) {
+        std::size_t size = 2;
+        while (size < capacity)
+            size <<= 1;
+        mask = size - 1;
+        slots = std::make_unique<T[]>(size);
+    }
+
+    Queue(const Queue &) = delete;
+    Queue &operator=(const Queue &) = delete;
+
+    std::size_t capacity() const { return mask + 1; }
+
+    // producer side. `item` is only moved from when it went in, so a failed
+    // push can be retried with the same item.
+    template <typename U> bool push(U &&item) {
+        const std::size_t at = tail.load(std::memory_order_relaxed);
+        if (at - headseen > mask) {
+            headseen = head.load(std::memory_order_acquire);
+            if (at - headseen > mask)
+                return false;
+        }
+        slots[at & mask] = std::forward<U>(item);
+        tail.store(at + 1, std::memory_order_release);
+        return true;
+    }
+
+    // consumer side
+    std::optional<T> pop() {
+        const std::size_t at = head.load(std::memory_order_relaxed);
+        if (at == tailseen) {
+            tailseen = tail.load(std::memory_order_acquire);
+            if (at == tailseen)
+                return std::nullopt;
+        }
+        std::optional<T> item(std::move(slots[at & mask]));
+        head.store(at + 1, std::memory_order_release);
+        return item;
+    }
+
+    // either side, a snapshot that may already be out of date
+    bool empty() const {
+        return head.load(std::memory_order_acquire) ==
+               tail.load(std::memory_order_acquire);
+    }
+};
@@ -0,0 +1,143 @@
+// render cache
+
+#pragma once
+
+#include <list>
+#include <optional>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+
+#include "editor.hpp"
+
+// tab-expanded text for the lines around the viewport, and where their rows
+// start once wrapped. a line without tabs renders as itself and is handed
+// out straight from the buffer; only lines with tabs get an expanded copy.
+// both are kept in a small LRU that follows edits through the editor's log
+// and forgets whatever falls off the end.
+class RenderCache {
+  private:
+    struct entry {
+        int lineid;
+        bool expanded = false; // has tabs, so `render` is what is shown
+        std::string render;
+        std::optional<wrapping> wrapped;
+    };
+    std::list<entry> recent; // most recently used first
+    std::unordered_map<int, std::list<entry>::iterator> where;
+    std::size_t bytes = 0;
+    long synced = -1;
+
+    static constexpr std::size_t CAPACITY = 1024;
+    static constexpr std::size_t BUDGET = 4 << 20;
+
+    static std::size_t cost(const entry &e) {
+        std::size_t held = e.render.capacity();
+        if (e.wrapped)
+            held += e.wrapped->starts.capacity() * sizeof(int) +
+                    e.wrapped->bytes.capacity() * sizeof(std::size_t);
+        return held;
+    }
+
+    void evict() {
+        while (recent.size() > 1 &&
+               (recent.size() > CAPACITY || bytes > BUDGET)) {
+            bytes -= cost(recent.back());
+            where.erase(recent.back().lineid);
+            recent.pop_back();
+        }
+    }
+
+    // the entry for `lineid`, made if there is none, moved to the front
+    entry &lookup(Editor &editor, int lineid) {
+        if (auto found = where.find(lineid); found != where.end()) {
+            recent.splice(recent.begin(), recent, found->second);
+            return recent.front();
+        }
+        recent.push_front({lineid});
+        entry &made = recent.front();
+        const std::string_view chars = editor.chars_at(lineid);
+        const char *end = chars.data() + chars.size();
+        if (scan::find(chars.data(), end, '\t') != end) {
+            made.expanded = true;
+            expand_tabs(chars, made.render);
+            bytes += cost(made);
+        }
+        where.emplace(lineid, recent.begin());
+        return made;
+    }
+
+  public:
+    // bytes of rendered text and row tables held
+    std::size_t footprint() const { return bytes; }
+
+    void clear() {
+        recent.clear();
+        where.clear();
+        bytes = 0;
+    }
+
+    // moves cached lines along with the edits made since the last call and
+    // drops the ones that changed
+    void sync(Editor &editor) {
+        auto edits = editor.edits_since(synced);
+        synced = editor.version();
+        if (!edits) {
+            clear();
+            return;
+        }
+        if (edits->empty() || recent.empty())
+            return;
+
+        for (const edit &e : *edits) {
+            const int gone = e.lineid + e.removed;
+            for (auto it = recent.begin(); it != recent.end();) {
+                if (it->lineid >= gone) {
+                    it->lineid += e.added - e.removed;
+                } else if (it->lineid >= e.lineid) {
+                    bytes -= cost(*it);
+                    it = recent.erase(it);
+                    continue;
+                }
+                ++it;
+            }
+        }
+
+        where.clear();
+        for (auto it = recent.begin(); it != recent.end(); ++it)
+            where.emplace(it->lineid, it);
+    }
+
+    // the rendered text of `lineid`. the view stays good until the next
+    // edit or the next call to get() or wrapped().
+    std::string_view get(Editor &editor, int lineid) {
+        sync(editor);
+        if (!where.contains(lineid)) {
+            const std::string_view chars = editor.chars_at(lineid);
+            const char *end = chars.data() + chars.size();
+            if (scan::find(chars.data(), end, '\t') == end)
+                return chars;
+        }
+        // an entry just made is at the front, and eviction always leaves at
+        // least one behind
+        entry &e = lookup(editor, lineid);
+        evict();
+        return e.expanded ? std::string_view(e.render)
+                          : editor.chars_at(lineid);
+    }
+
+    // where the rows of `lineid` start wrapped at `width` columns, walked
+    // once for each version of the line. good until the next edit or the
+    // next call to get() or wrapped().
+    const wrapping &wrapped(Editor &editor, int lineid, int width) {
+        sync(editor);
+        entry &e = lookup(editor, lineid);
+        if (!e.wrapped || e.wrapped->width != std::max(1, width)) {
+            bytes -= cost(e);
+            e.wrapped = wrap(editor.chars_at(lineid), width);
+            bytes += cost(e);
+        }
+        evict();
+        return *e.wrapped;
+    }
+};
@@ -0,0 +1,356 @@
+// rope
+
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <stdexcept>
+#include <utility>
+#include <vector>
+
+#include "slabs.hpp"
+
+// an implicit treap: a sequence container where positional lookup, insert,
+// erase, split and concatenation are all O(log n). every node also caches the
+// summed "measure" of its subtree, so prefix sums and "which element holds
+// the k-th unit" queries are O(log n) as well. elements never move once
+// inserted, so references stay valid until that element is erased. nodes
+// come from a set of Slabs, which ropes that splice into each other share.
+
+struct unit_measure {
+    template <typename T> int operator()(const T &) const { return 1; }
+};
+
+template <typename T, typename Measure = unit_measure> class Rope {
+  public:
+    using weight = decltype(Measure{}(std::declval<const T &>()));
+
+  private:
+    struct node;
+    struct release {
+        void operator()(node *n) const {
+            n->~node();
+            Slabs::release(n);
+        }
+    };
+    using link = std::unique_ptr<node, release>;
+
+    struct node {
+        T value;
+        link left;
+        link right;
+        std::uint32_t priority;
+        std::size_t count;
+        weight total;
+
+        node(T &&v, std::uint32_t p)
+            : value(std::move(v)), priority(p), count(1),
+              total(Measure{}(value)) {}
+    };
+    static_assert(sizeof(node) <= Slabs::LARGEST);
+
+    std::shared_ptr<Slabs> slabs = Slabs::fallback();
+    link root;
+    std::uint32_t seed =
+        static_cast<std::uint32_t>(reinterpret_cast<std::uintptr_t>(this) >> 4) |
+        1u;
+
+    std::uint32_t roll() {
+        // xorshift32, plenty for keeping the tree balanced
+        seed ^= seed << 13;
+        seed ^= seed >> 17;
+        seed ^= seed << 5;
+        return seed;
+    }
+
+    link make(T &&value) {
+        void *at = slabs->allocate(sizeof(node));
+        try {
+            return link(new (at) node(std::move(value), roll()));
+        } catch (...) {
+            Slabs::release(at);
+            throw;
+        }
+    }
+
+    static std::size_t count_of(const link &n) { return n ? n->count : 0; }
+    static weight total_of(const link &n) { return n ? n->total : weight{}; }
+
+    static void pull(node *n) {
+        n->count = 1 + count_of(n->left) + count_of(n->right);
+        n->total = total_of(n->left) + Measure{}(n->value) + total_of(n->right);
+    }
+
+    static link merge(link a, link b) {
+        if (!a)
+            return b;
+        if (!b)
+            return a;
+        if (a->priority > b->priority) {
+            a->right = merge(std::move(a->right), std::move(b));
+            pull(a.get());
+            return a;
+        }
+        b->left = merge(std::move(a), std::move(b->left));
+        pull(b.get());
+        return b;
+    }
+
+    // first `k` elements go left, the rest go right
+    static std::pair<link, link> split(link n, std::size_t k) {
+        if (!n)
+            return {nullptr, nullptr};
+        const std::size_t leftcount = count_of(n->left);
+        if (k <= leftcount) {
+            auto [a, b] = split(std::move(n->left), k);
+            n->left = std::move(b);
+            pull(n.get());
+            return {std::move(a), std::move(n)};
+        }
+        auto [a, b] = split(std::move(n->right), k - leftcount - 1);
+        n->right = std::move(a);
+        pull(n.get());
+        return {std::move(n), std::move(b)};
+    }
+
+    node *find(std::size_t index) const {
+        node *n = root.get();
+        while (n) {
+            const std::size_t leftcount = count_of(n->left);
+            if (index < leftcount) {
+                n = n->left.get();
+            } else if (index == leftcount) {
+                return n;
+            } else {
+                index -= leftcount + 1;
+                n = n->right.get();
+            }
+        }
+        return nullptr;
+    }
+
+    link build(std::vector<T> &values, std::size_t lo, std::size_t hi) {
+        if (lo >= hi)
+            return nullptr;
+        const std::size_t mid = lo + (hi - lo) / 2;
+        link n = make(std::move(values[mid]));
+        n->left = build(values, lo, mid);
+        n->right = build(values, mid + 1, hi);
+        heapify(n.get());
+        pull(n.get());
+        return n;
+    }
+
+    static void heapify(node *n) {
+        // restores heap order on priorities only, so the shape (and with it
+        // the element order and subtree sums) stays untouched
+        while (true) {
+            node *top = n;
+            if (n->left && n->left->priority > top->priority)
+                top = n->left.get();
+            if (n->right && n->right->priority > top->priority)
+                top = n->right.get();
+            if (top == n)
+                return;
+            std::swap(n->priority, top->priority);
+            n = top;
+        }
+    }
+
+    static void refresh(node *n, std::size_t index) {
+        // recomputes sums along the path to `index`
+        const std::size_t leftcount = count_of(n->left);
+        if (index < leftcount)
+            refresh(n->left.get(), index);
+        else if (index > leftcount)
+            refresh(n->right.get(), index - leftcount - 1);
+        pull(n);
+    }
+
+  public:
+    // the size of the node each element lives in, the element included
+    static constexpr std::size_t NODEBYTES = sizeof(node);
+
+    Rope() = default;
+    explicit Rope(std::shared_ptr<Slabs> from) : slabs(std::move(from)) {}
+    explicit Rope(std::vector<T> values,
+                  std::shared_ptr<Slabs> from = Slabs::fallback())
+        : slabs(std::move(from)) {
+        assign(std::move(values));
+    }
+
+    // the moved-from rope is left empty but still able to take elements
+    Rope(Rope &&other) noexcept
+        : slabs(other.slabs), root(std::move(other.root)) {}
+    Rope &operator=(Rope &&other) noexcept {
+        if (this != &other) {
+            clear();
+            slabs = other.slabs;
+            root = std::move(other.root);
+        }
+        return *this;
+    }
+
+    // where its nodes come from, for ropes that will be spliced into it
+    const std::shared_ptr<Slabs> &allocator() const { return slabs; }
+
+    ~Rope() { clear(); }
+
+    std::size_t size() const { return count_of(root); }
+    bool empty() const { return !root; }
+    weight total() const { return total_of(root); }
+
+    void clear() {
+        // tear down iteratively along the spine, a degenerate tree would
+        // otherwise recurse as deep as it is tall
+        while (root) {
+            if (root->left) {
+                link l = std::move(root->left);
+                root->left = std::move(l->right);
+                l->right = std::move(root);
+                root = std::move(l);
+            } else {
+                root = std::move(root->right);
+            }
+        }
+    }
+
+    void assign(std::vector<T> values) {
+        clear();
+        root = build(values, 0, values.size());
+    }
+
+    T &at(std::size_t index) {
+        node *n = find(index);
+        if (!n)
+            throw std::out_of_range("Rope::at(): index out of range");
+        return n->value;
+    }
+    const T &at(std::size_t index) const {
+        node *n = find(index);
+        if (!n)
+            throw std::out_of_range("Rope::at(): index out of range");
+        return n->value;
+    }
+
+    T &insert(std::size_t where, T value) {
+        link n = make(std::move(value));
+        node *raw = n.get();
+        auto [a, b] = split(std::move(root), where);
+        root = merge(merge(std::move(a), std::move(n)), std::move(b));
+        return raw->value;
+    }
+
+    T &push_back(T value) { return insert(size(), std::move(value)); }
+
+    void erase(std::size_t first, std::size_t last) {
+        if (first >= last)
+            return;
+        auto [a, rest] = split(std::move(root), first);
+        auto [doomed, b] = split(std::move(rest), last - first);
+        root = merge(std::move(a), std::move(b));
+        Rope(std::move(doomed), slabs).clear();
+    }
+    void erase(std::size_t which) { erase(which, which + 1); }
+
+    // moves every element of `other` in front of position `where`
+    void splice(std::size_t where, Rope &&other) {
+        auto [a, b] = split(std::move(root), where);
+        root = merge(merge(std::move(a), std::move(other.root)), std::move(b));
+    }
+
+    // detaches elements [first, last) into their own rope
+    Rope extract(std::size_t first, std::size_t last) {
+        auto [a, rest] = split(std::move(root), first);
+        auto [mid, b] = split(std::move(rest), last - first);
+        root = merge(std::move(a), std::move(b));
+        return Rope(std::move(mid), slabs);
+    }
+
+    // call after changing an element in a way that changes its measure
+    void remeasure(std::size_t index) {
+        if (index < size())
+            refresh(root.get(), index);
+    }
+
+    // summed measure of the first `k` elements
+    weight prefix(std::size_t k) const {
+        weight sum{};
+        node *n = root.get();
+        while (n && k > 0) {
+            const std::size_t leftcount = count_of(n->left);
+            if (k <= leftcount) {
+                n = n->left.get();
+            } else {
+                sum = sum + total_of(n->left) + Measure{}(n->value);
+                k -= leftcount + 1;
+                n = n->right.get();
+            }
+        }
+        return sum;
+    }
+
+    // finds the first element at which `reached(prefix through it)` holds.
+    // `reached` must be monotone along the sequence. returns the element's
+    // index and the measure of everything before it, or size() when no
+    // element qualifies.
+    template <typename Pred>
+    std::pair<std::size_t, weight> search(Pred reached) const {
+        weight before{};
+        std::size_t index = 0;
+        node *n = root.get();
+        while (n) {
+            const weight withleft = before + total_of(n->left);
+            if (n->left && reached(withleft)) {
+                n = n->left.get();
+                continue;
+            }
+            const weight withself = withleft + Measure{}(n->value);
+            if (reached(withself))
+                return {index + count_of(n->left), withleft};
+            before = withself;
+            index += count_of(n->left) + 1;
+            n = n->right.get();
+        }
+        return {index, before};
+    }
+
+    // in-order walk starting at `from`; stops early once `fn` returns false
+    template <typename Fn> void visit(std::size_t from, Fn &&fn) {
+        std::vector<node *> stack;
+        node *n = root.get();
+        while (n) {
+            const std::size_t leftcount = count_of(n->left);
+            if (from < leftcount) {
+                stack.push_back(n);
+                n = n->left.get();
+            } else if (from == leftcount) {
+                stack.push_back(n);
+                break;
+            } else {
+                from -= leftcount + 1;
+                n = n->right.get();
+            }
+        }
+        while (!stack.empty()) {
+            n = stack.back();
+            stack.pop_back();
+            if (!fn(n->value))
+                return;
+            for (node *r = n->right.get(); r; r = r->left.get())
+                stack.push_back(r);
+        }
+    }
+
+    template <typename Fn> void for_each(Fn &&fn) {
+        visit(0, [&](T &value) {
+            fn(value);
+            return true;
+        });
+    }
+
+  private:
+    Rope(link tree, std::shared_ptr<Slabs> from)
+        : slabs(std::move(from)), root(std::move(tree)) {}
+};
@@ -0,0 +1,226 @@
+// saving
+
+#pragma once
+
+#include <atomic>
+#include <cerrno>
+#include <climits>
+#include <cstring>
+#include <fcntl.h>
+#include <filesystem>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+#include <sys/stat.h>
+#include <sys/uio.h>
+#include <thread>
+#include <unistd.h>
+#include <vector>
+
+#include "editor.hpp"
+
+// gathers byte spans and hands them to writev in batches, so nothing gets
+// copied on the way to the file
+class SpanWriter {
+  private:
+    int fd;
+    std::vector<iovec> pending;
+    std::size_t total = 0;
+
+  public:
+    explicit SpanWriter(int fd) : fd(fd) { pending.reserve(IOV_MAX); }
+
+    void add(std::string_view bytes) {
+        if (bytes.empty())
+            return;
+        pending.push_back(
+            {const_cast<char *>(bytes.data()), bytes.size()}); // writev only reads
+        if (pending.size() == IOV_MAX)
+            flush();
+    }
+
+    void flush() {
+        iovec *at = pending.data();
+        int left = static_cast<int>(pending.size());
+        while (left > 0) {
+            const ssize_t wrote = writev(fd, at, left);
+            if (wrote < 0) {
+                if (errno == EINTR)
+                    continue;
+                throw std::runtime_error(std::strerror(errno));
+            }
+            total += static_cast<std::size_t>(wrote);
+
+            // skip past whatever made it out, a short write can stop midway
+            // through a span
+            std::size_t done = static_cast<std::size_t>(wrote);
+            while (left > 0 && done >= at->iov_len) {
+                done -= at->iov_len;
+                at++;
+                left--;
+            }
+            if (left > 0) {
+                at->iov_base = static_cast<char *>(at->iov_base) + done;
+                at->iov_len -= done;
+            }
+        }
+        pending.clear();
+    }
+
+    std::size_t written() const { return total; }
+};
+
+// writes whatever `produce` feeds the writer to a temporary file next to
+// `path`, syncs it and renames it into place. a crash midway leaves either the
+// old file or the new one, never half of each. returns the bytes written.
+inline std::size_t write_atomically(
+    const std::string &path, const std::function<void(SpanWriter &)> &produce) {
+    std::string temp = path + ".XXXXXX";
+    const int fd = mkstemp(temp.data());
+    if (fd == -1)
+        throw std::runtime_error(std::strerror(errno));
+
+    auto fail = [&](int error) {
+        close(fd);
+        unlink(temp.c_str());
+        throw std::runtime_error(std::strerror(error));
+    };
+
+    // keep the permissions of the file being replaced
+    struct stat st;
+    const mode_t mode = stat(path.c_str(), &st) == 0 ? st.st_mode & 07777 : 0644;
+    if (fchmod(fd, mode) == -1)
+        fail(errno);
+
+    SpanWriter out(fd);
+    try {
+        produce(out);
+        out.flush();
+    } catch (...) {
+        close(fd);
+        unlink(temp.c_str());
+        throw;
+    }
+
+    if (fsync(fd) == -1)
+        fail(errno);
+    if (close(fd) == -1) {
+        unlink(temp.c_str());
+        throw std::runtime_error(std::strerror(errno));
+    }
+    if (rename(temp.c_str(), path.c_str()) == -1) {
+        const int error = errno;
+        unlink(temp.c_str());
+        throw std::runtime_error(std::strerror(error));
+    }
+
+    // make the rename itself durable
+    const std::string dir =
+        std::filesystem::path(path).parent_path().string();
+    const int dirfd = ::open(dir.empty() ? "." : dir.c_str(), O_RDONLY);
+    if (dirfd != -1) {
+        fsync(dirfd);
+        close(dirfd);
+    }
+
+    return out.written();
+}
+
+// saves a buffer off the UI thread. the save works from a snapshot: edited
+// lines are copied, untouched runs are only referenced. when the edited lines
+// are too big to copy cheaply the buffer is streamed out in place instead.
+class Saver {
+  public:
+    struct outcome {
+        std::string error; // empty on success
+        std::size_t bytes;
+        long version; // editor version that was saved
+    };
+
+  private:
+    std::atomic<bool> running{false};
+    std::mutex guard;
+    std::optional<outcome> finished;
+    std::jthread worker; // last, so it is joined before the rest goes away
+
+    static constexpr std::size_t SNAPSHOTLIMIT = 64 << 20;
+
+    void report(outcome done) {
+        std::lock_guard<std::mutex> hold(guard);
+        finished = std::move(done);
+    }
+
+  public:
+    // the caller holds the editor lock
+    void start(Editor &editor, const std::string &path) {
+        wait();
+        const long version = editor.version();
+
+        std::size_t ownedbytes = 0;
+        editor.visit_spans([&](std::string_view bytes, bool owned) {
+            if (owned)
+                ownedbytes += bytes.size();
+        });
+
+        if (ownedbytes > SNAPSHOTLIMIT) {
+            try {
+                const std::size_t bytes =
+                    write_atomically(path, [&](SpanWriter &out) {
+                        editor.visit_spans(
+                            [&](std::string_view bytes, bool) { out.add(bytes); });
+                    });
+                report({"", bytes, version});
+            } catch (const std::runtime_error &e) {
+                report({e.what(), 0, version});
+            }
+            return;
+        }
+
+        // reserved up front, so the views into it never move
+        auto arena = std::make_shared<std::string>();
+        arena->reserve(ownedbytes);
+        auto spans = std::make_shared<std::vector<std::string_view>>();
+        editor.visit_spans([&](std::string_view bytes, bool owned) {
+            if (!owned) {
+                spans->push_back(bytes);
+                return;
+            }
+            const char *at = arena->data() + arena->size();
+            arena->append(bytes);
+            spans->push_back({at, bytes.size()});
+        });
+
+        running = true;
+        worker = std::jthread([this, path, version, arena, spans,
+                               keep = editor.sources()] {
+            try {
+                const std::size_t bytes =
+                    write_atomically(path, [&](SpanWriter &out) {
+                        for (std::string_view bytes : *spans)
+                            out.add(bytes);
+                    });
+                report({"", bytes, version});
+            } catch (const std::runtime_error &e) {
+                report({e.what(), 0, version});
+            }
+            running = false;
+        });
+    }
+
+    bool saving() const { return running; }
+
+    void wait() {
+        if (worker.joinable())
+            worker.join();
+    }
+
+    // how the last save went, once, after it is done
+    std::optional<outcome> collect() {
+        std::lock_guard<std::mutex> hold(guard);
+        return std::exchange(finished, std::nullopt);
+    }
+};
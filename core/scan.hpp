@@ -0,0 +1,407 @@
+// byte scanning
+
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+
+#if defined(__x86_64__)
+#include <immintrin.h>
+#define SCAN_X86 1
+#elif defined(__aarch64__) && defined(__ARM_NEON)
+#include <arm_neon.h>
+#define SCAN_NEON 1
+#endif
+
+// the byte loops behind line splitting, tab expansion and column mapping.
+// each kernel has a scalar version and vector versions, and the best one the
+// cpu supports is picked once at runtime.
+namespace scan {
+
+struct kernels {
+    const char *name;
+    // first `c` in [first, last), or last
+    const char *(*find)(const char *first, const char *last, char c);
+    // first `a` or `b` in [first, last), or last
+    const char *(*find2)(const char *first, const char *last, char a, char b);
+    // how many times `c` appears in [first, last)
+    std::size_t (*count)(const char *first, const char *last, char c);
+    // first occurrence of the `len` bytes at `needle` in [first, last), or
+    // last
+    const char *(*search)(const char *first, const char *last,
+                          const char *needle, std::size_t len);
+    // first byte in [first, last) that is `c` or at or above `floor`, or
+    // last. with '\t' and 0x80 it finds where plain ascii text stops being
+    // a column a byte.
+    const char *(*stop)(const char *first, const char *last, char c,
+                        unsigned char floor);
+};
+
+inline const char *find_scalar(const char *first, const char *last, char c) {
+    while (first < last && *first != c)
+        first++;
+    return first;
+}
+
+inline const char *find2_scalar(const char *first, const char *last, char a,
+                                char b) {
+    while (first < last && *first != a && *first != b)
+        first++;
+    return first;
+}
+
+inline std::size_t count_scalar(const char *first, const char *last, char c) {
+    std::size_t n = 0;
+    for (; first < last; first++)
+        n += *first == c;
+    return n;
+}
+
+inline const char *search_scalar(const char *first, const char *last,
+                                 const char *needle, std::size_t len) {
+    if (len == 0)
+        return first;
+    if (static_cast<std::size_t>(last - first) < len)
+        return last;
+    const char *stop = last - len + 1; // last place a match can start
+    while ((first = find_scalar(first, stop, needle[0])) < stop) {
+        if (std::memcmp(first + 1, needle + 1, len - 1) == 0)
+            return first;
+        first++;
+    }
+    return last;
+}
+
+inline const char *stop_scalar(const char *first, const char *last, char c,
+                               unsigned char floor) {
+    while (first < last && *first != c &&
+           static_cast<unsigned char>(*first) < floor)
+        first++;
+    return first;
+}
+
+#if SCAN_X86
+
+__attribute__((target("sse2"))) inline const char *
+find_sse2(const char *first, const char *last, char c) {
+    const __m128i needle = _mm_set1_epi8(c);
+    for (; last - first >= 16; first += 16) {
+        const __m128i block =
+            _mm_loadu_si128(reinterpret_cast<const __m128i *>(first));
+        const int mask = _mm_movemask_epi8(_mm_cmpeq_epi8(block, needle));
+        if (mask)
+            return first + __builtin_ctz(static_cast<unsigned>(mask));
+    }
+    return find_scalar(first, last, c);
+}
+
+__attribute__((target("sse2"))) inline const char *
+find2_sse2(const char *first, const char *last, char a, char b) {
+    const __m128i na = _mm_set1_epi8(a);
+    const __m128i nb = _mm_set1_epi8(b);
+    for (; last - first >= 16; first += 16) {
+        const __m128i block =
+            _mm_loadu_si128(reinterpret_cast<const __m128i *>(first));
+        const int mask = _mm_movemask_epi8(_mm_or_si128(
+            _mm_cmpeq_epi8(block, na), _mm_cmpeq_epi8(block, nb)));
+        if (mask)
+            return first + __builtin_ctz(static_cast<unsigned>(mask));
+    }
+    return find2_scalar(first, last, a, b);
+}
+
+__attribute__((target("sse2"))) inline std::size_t
+count_sse2(const char *first, const char *last, char c) {
+    const __m128i needle = _mm_set1_epi8(c);
+    std::size_t n = 0;
+    while (last - first >= 16) {
+        // matches are -1, so subtracting them counts up in each byte lane.
+        // lanes are folded into the total before they can wrap.
+        __m128i lanes = _mm_setzero_si128();
+        for (int round = 0; round < 255 && last - first >= 16;
+             round++, first += 16) {
+            const __m128i block =
+                _mm_loadu_si128(reinterpret_cast<const __m128i *>(first));
+            lanes = _mm_sub_epi8(lanes, _mm_cmpeq_epi8(block, needle));
+        }
+        const __m128i sums = _mm_sad_epu8(lanes, _mm_setzero_si128());
+        n += static_cast<std::size_t>(_mm_cvtsi128_si32(sums)) +
+             static_cast<std::size_t>(
+                 _mm_cvtsi128_si32(_mm_srli_si128(sums, 8)));
+    }
+    return n + count_scalar(first, last, c);
+}
+
+// candidates are where both the first and the last byte of the needle line
+// up, which rules out nearly everything before memcmp has to look
+__attribute__((target("sse2"))) inline const char *
+search_sse2(const char *first, const char *last, const char *needle,
+            std::size_t len) {
+    if (len < 2 || static_cast<std::size_t>(last - first) < len)
+        return search_scalar(first, last, needle, len);
+    const __m128i head = _mm_set1_epi8(needle[0]);
+    const __m128i tail = _mm_set1_epi8(needle[len - 1]);
+    const char *stop = last - len + 1;
+    for (; stop - first >= 16; first += 16) {
+        const __m128i a =
+            _mm_loadu_si128(reinterpret_cast<const __m128i *>(first));
+        const __m128i b =
+            _mm_loadu_si128(reinterpret_cast<const __m128i *>(first + len - 1));
+        unsigned mask = static_cast<unsigned>(_mm_movemask_epi8(
+            _mm_and_si128(_mm_cmpeq_epi8(a, head), _mm_cmpeq_epi8(b, tail))));
+        while (mask) {
+            const char *at = first + __builtin_ctz(mask);
+            if (std::memcmp(at + 1, needle + 1, len - 2) == 0)
+                return at;
+            mask &= mask - 1;
+        }
+    }
+    return search_scalar(first, last, needle, len);
+}
+
+// a byte is at or above the floor when the unsigned max leaves it alone
+__attribute__((target("sse2"))) inline const char *
+stop_sse2(const char *first, const char *last, char c, unsigned char floor) {
+    const __m128i needle = _mm_set1_epi8(c);
+    const __m128i low = _mm_set1_epi8(static_cast<char>(floor));
+    for (; last - first >= 16; first += 16) {
+        const __m128i block =
+            _mm_loadu_si128(reinterpret_cast<const __m128i *>(first));
+        const int mask = _mm_movemask_epi8(
+            _mm_or_si128(_mm_cmpeq_epi8(block, needle),
+                         _mm_cmpeq_epi8(_mm_max_epu8(block, low), block)));
+        if (mask)
+            return first + __builtin_ctz(static_cast<unsigned>(mask));
+    }
+    return stop_scalar(first, last, c, floor);
+}
+
+__attribute__((target("avx2"))) inline const char *
+find_avx2(const char *first, const char *last, char c) {
+    const __m256i needle = _mm256_set1_epi8(c);
+    for (; last - first >= 32; first += 32) {
+        const __m256i block =
+            _mm256_loadu_si256(reinterpret_cast<const __m256i *>(first));
+        const unsigned mask = static_cast<unsigned>(
+            _mm256_movemask_epi8(_mm256_cmpeq_epi8(block, needle)));
+        if (mask)
+            return first + __builtin_ctz(mask);
+    }
+    return find_sse2(first, last, c);
+}
+
+__attribute__((target("avx2"))) inline const char *
+find2_avx2(const char *first, const char *last, char a, char b) {
+    const __m256i na = _mm256_set1_epi8(a);
+    const __m256i nb = _mm256_set1_epi8(b);
+    for (; last - first >= 32; first += 32) {
+        const __m256i block =
+            _mm256_loadu_si256(reinterpret_cast<const __m256i *>(first));
+        const unsigned mask = static_cast<unsigned>(_mm256_movemask_epi8(
+            _mm256_or_si256(_mm256_cmpeq_epi8(block, na),
+                            _mm256_cmpeq_epi8(block, nb))));
+        if (mask)
+            return first + __builtin_ctz(mask);
+    }
+    return find2_sse2(first, last, a, b);
+}
+
+__attribute__((target("avx2"))) inline std::size_t
+count_avx2(const char *first, const char *last, char c) {
+    const __m256i needle = _mm256_set1_epi8(c);
+    std::size_t n = 0;
+    while (last - first >= 32) {
+        __m256i lanes = _mm256_setzero_si256();
+        for (int round = 0; round < 255 && last - first >= 32;
+             round++, first += 32) {
+            const __m256i block =
+                _mm256_loadu_si256(reinterpret_cast<const __m256i *>(first));
+            lanes = _mm256_sub_epi8(lanes, _mm256_cmpeq_epi8(block, needle));
+        }
+        const __m256i sums = _mm256_sad_epu8(lanes, _mm256_setzero_si256());
+        n += static_cast<std::size_t>(_mm256_extract_epi64(sums, 0)) +
+             static_cast<std::size_t>(_mm256_extract_epi64(sums, 1)) +
+             static_cast<std::size_t>(_mm256_extract_epi64(sums, 2)) +
+             static_cast<std::size_t>(_mm256_extract_epi64(sums, 3));
+    }
+    return n + count_sse2(first, last, c);
+}
+
+__attribute__((target("avx2"))) inline const char *
+search_avx2(const char *first, const char *last, const char *needle,
+            std::size_t len) {
+    if (len < 2 || static_cast<std::size_t>(last - first) < len)
+        return search_scalar(first, last, needle, len);
+    const __m256i head = _mm256_set1_epi8(needle[0]);
+    const __m256i tail = _mm256_set1_epi8(needle[len - 1]);
+    const char *stop = last - len + 1;
+    for (; stop - first >= 32; first += 32) {
+        const __m256i a =
+            _mm256_loadu_si256(reinterpret_cast<const __m256i *>(first));
+        const __m256i b = _mm256_loadu_si256(
+            reinterpret_cast<const __m256i *>(first + len - 1));
+        unsigned mask = static_cast<unsigned>(_mm256_movemask_epi8(
+            _mm256_and_si256(_mm256_cmpeq_epi8(a, head),
+                             _mm256_cmpeq_epi8(b, tail))));
+        while (mask) {
+            const char *at = first + __builtin_ctz(mask);
+            if (std::memcmp(at + 1, needle + 1, len - 2) == 0)
+                return at;
+            mask &= mask - 1;
+        }
+    }
+    return search_sse2(first, last, needle, len);
+}
+
+__attribute__((target("avx2"))) inline const char *
+stop_avx2(const char *first, const char *last, char c, unsigned char floor) {
+    const __m256i needle = _mm256_set1_epi8(c);
+    const __m256i low = _mm256_set1_epi8(static_cast<char>(floor));
+    for (; last - first >= 32; first += 32) {
+        const __m256i block =
+            _mm256_loadu_si256(reinterpret_cast<const __m256i *>(first));
+        const unsigned mask = static_cast<unsigned>(_mm256_movemask_epi8(
+            _mm256_or_si256(
+                _mm256_cmpeq_epi8(block, needle),
+                _mm256_cmpeq_epi8(_mm256_max_epu8(block, low), block))));
+        if (mask)
+            return first + __builtin_ctz(mask);
+    }
+    return stop_sse2(first, last, c, floor);
+}
+
+#elif SCAN_NEON
+
+inline const char *find_neon(const char *first, const char *last, char c) {
+    const uint8x16_t needle = vdupq_n_u8(static_cast<uint8_t>(c));
+    for (; last - first >= 16; first += 16) {
+        const uint8x16_t block =
+            vld1q_u8(reinterpret_cast<const uint8_t *>(first));
+        if (vmaxvq_u8(vceqq_u8(block, needle)))
+            return find_scalar(first, first + 16, c);
+    }
+    return find_scalar(first, last, c);
+}
+
+inline const char *find2_neon(const char *first, const char *last, char a,
+                              char b) {
+    const uint8x16_t na = vdupq_n_u8(static_cast<uint8_t>(a));
+    const uint8x16_t nb = vdupq_n_u8(static_cast<uint8_t>(b));
+    for (; last - first >= 16; first += 16) {
+        const uint8x16_t block =
+            vld1q_u8(reinterpret_cast<const uint8_t *>(first));
+        if (vmaxvq_u8(vorrq_u8(vceqq_u8(block, na), vceqq_u8(block, nb))))
+            return find2_scalar(first, first + 16, a, b);
+    }
+    return find2_scalar(first, last, a, b);
+}
+
+inline std::size_t count_neon(const char *first, const char *last, char c) {
+    const uint8x16_t needle = vdupq_n_u8(static_cast<uint8_t>(c));
+    std::size_t n = 0;
+    while (last - first >= 16) {
+        uint8x16_t lanes = vdupq_n_u8(0);
+        for (int round = 0; round < 255 && last - first >= 16;
+             round++, first += 16) {
+            const uint8x16_t block =
+                vld1q_u8(reinterpret_cast<const uint8_t *>(first));
+            lanes = vsubq_u8(lanes, vceqq_u8(block, needle));
+        }
+        n += vaddlvq_u8(lanes);
+    }
+    return n + count_scalar(first, last, c);
+}
+
+inline const char *search_neon(const char *first, const char *last,
+                               const char *needle, std::size_t len) {
+    if (len < 2 || static_cast<std::size_t>(last - first) < len)
+        return search_scalar(first, last, needle, len);
+    const uint8x16_t head = vdupq_n_u8(static_cast<uint8_t>(needle[0]));
+    const uint8x16_t tail = vdupq_n_u8(static_cast<uint8_t>(needle[len - 1]));
+    const char *stop = last - len + 1;
+    for (; stop - first >= 16; first += 16) {
+        const uint8x16_t a = vld1q_u8(reinterpret_cast<const uint8_t *>(first));
+        const uint8x16_t b =
+            vld1q_u8(reinterpret_cast<const uint8_t *>(first + len - 1));
+        if (!vmaxvq_u8(vandq_u8(vceqq_u8(a, head), vceqq_u8(b, tail))))
+            continue;
+        for (const char *at = first; at < first + 16; at++) {
+            if (*at == needle[0] && std::memcmp(at + 1, needle + 1, len - 1) == 0)
+                return at;
+        }
+    }
+    return search_scalar(first, last, needle, len);
+}
+
+inline const char *stop_neon(const char *first, const char *last, char c,
+                             unsigned char floor) {
+    const uint8x16_t needle = vdupq_n_u8(static_cast<uint8_t>(c));
+    const uint8x16_t low = vdupq_n_u8(floor);
+    for (; last - first >= 16; first += 16) {
+        const uint8x16_t block =
+            vld1q_u8(reinterpret_cast<const uint8_t *>(first));
+        if (vmaxvq_u8(vorrq_u8(vceqq_u8(block, needle), vcgeq_u8(block, low))))
+            return stop_scalar(first, first + 16, c, floor);
+    }
+    return stop_scalar(first, last, c, floor);
+}
+
+#endif
+
+inline const kernels &scalar() {
+    static const kernels k{"scalar",     find_scalar,   find2_scalar,
+                           count_scalar, search_scalar, stop_scalar};
+    return k;
+}
+
+inline const kernels &pick() {
+#if SCAN_X86
+    static const kernels avx2{"avx2",     find_avx2,   find2_avx2,
+                              count_avx2, search_avx2, stop_avx2};
+    static const kernels sse2{"sse2",     find_sse2,   find2_sse2,
+                              count_sse2, search_sse2, stop_sse2};
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx2"))
+        return avx2;
+    if (__builtin_cpu_supports("sse2"))
+        return sse2;
+#elif SCAN_NEON
+    static const kernels neon{"neon",     find_neon,   find2_neon,
+                              count_neon, search_neon, stop_neon};
+    return neon;
+#endif
+    return scalar();
+}
+
+// the kernels in use, chosen on first call
+inline const kernels &active() {
+    static const kernels &k = pick();
+    return k;
+}
+
+inline const char *find(const char *first, const char *last, char c) {
+    return active().find(first, last, c);
+}
+inline const char *find2(const char *first, const char *last, char a,
+                         char b) {
+    return active().find2(first, last, a, b);
+}
+inline std::size_t count(const char *first, const char *last, char c) {
+    return active().count(first, last, c);
+}
+inline const char *search(const char *first, const char *last,
+                          const char *needle, std::size_t len) {
+    return active().search(first, last, needle, len);
+}
+inline const char *stop(const char *first, const char *last, char c,
+                        unsigned char floor) {
+    return active().stop(first, last, c, floor);
+}
+// first byte at or above `floor`
+inline const char *above(const char *first, const char *last,
+                         unsigned char floor) {
+    return active().stop(first, last, static_cast<char>(floor), floor);
+}
+
+} // namespace scan
@@ -0,0 +1,112 @@
+// slabs
+
+#pragma once
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <cstdlib>
+#include <memory>
+#include <mutex>
+#include <new>
+#include <vector>
+
+// small fixed-size blocks for the nodes of many ropes at once, carved out of
+// aligned slabs of one block size each. a block finds its way home from its
+// address alone, so nodes carry nothing extra and can be freed by any rope.
+// the buffers of a workspace all draw on one set: what one lets go of the
+// next reuses, and a node costs its own size rather than a heap allocation.
+class Slabs {
+  private:
+    static constexpr std::size_t SLAB = 64 << 10;
+    static constexpr std::size_t GRAIN = 16;
+    static constexpr std::size_t CLASSES = 32;
+
+    // at the start of every slab
+    struct header {
+        Slabs *owner;
+        std::size_t size; // of its blocks
+    };
+    struct block {
+        block *next;
+    };
+
+    std::mutex guard;
+    block *spare[CLASSES] = {}; // free blocks of each size
+    std::vector<void *> slabs;
+    std::size_t handed = 0; // bytes of blocks in use
+
+    static std::size_t grade(std::size_t bytes) {
+        return (std::max<std::size_t>(bytes, 1) + GRAIN - 1) / GRAIN - 1;
+    }
+
+    void grow(std::size_t which) {
+        void *slab = std::aligned_alloc(SLAB, SLAB);
+        if (!slab)
+            throw std::bad_alloc();
+        slabs.push_back(slab);
+        const std::size_t size = (which + 1) * GRAIN;
+        new (slab) header{this, size};
+        auto *base = static_cast<std::byte *>(slab);
+        const std::size_t first = (sizeof(header) + GRAIN - 1) / GRAIN * GRAIN;
+        for (std::size_t at = first; at + size <= SLAB; at += size)
+            spare[which] = new (base + at) block{spare[which]};
+    }
+
+    void put(void *freed, std::size_t size) {
+        const std::lock_guard<std::mutex> hold(guard);
+        const std::size_t which = grade(size);
+        spare[which] = new (freed) block{spare[which]};
+        handed -= size;
+    }
+
+  public:
+    // the biggest block handed out
+    static constexpr std::size_t LARGEST = CLASSES * GRAIN;
+
+    Slabs() = default;
+    Slabs(const Slabs &) = delete;
+    Slabs &operator=(const Slabs &) = delete;
+
+    ~Slabs() {
+        for (void *slab : slabs)
+            std::free(slab);
+    }
+
+    void *allocate(std::size_t bytes) {
+        const std::lock_guard<std::mutex> hold(guard);
+        const std::size_t which = grade(bytes);
+        if (!spare[which])
+            grow(which);
+        block *taken = spare[which];
+        spare[which] = taken->next;
+        handed += (which + 1) * GRAIN;
+        return taken;
+    }
+
+    // hands a block back to the slabs it came from, whichever they are
+    static void release(void *freed) {
+        const auto slab =
+            reinterpret_cast<std::uintptr_t>(freed) & ~std::uintptr_t{SLAB - 1};
+        const header *h = reinterpret_cast<const header *>(slab);
+        h->owner->put(freed, h->size);
+    }
+
+    // bytes of blocks in use, and of slabs taken from the system
+    std::size_t used() {
+        const std::lock_guard<std::mutex> hold(guard);
+        return handed;
+    }
+    std::size_t reserved() {
+        const std::lock_guard<std::mutex> hold(guard);
+        return slabs.size() * SLAB;
+    }
+
+    // the slabs for ropes not given any, e.g. an editor outside a workspace.
+    // never freed, so no rope can outlive them.
+    static const std::shared_ptr<Slabs> &fallback() {
+        static const auto *shared =
+            new std::shared_ptr<Slabs>(std::make_shared<Slabs>());
+        return *shared;
+    }
+};
@@ -0,0 +1,186 @@
+// buffer snapshots
+
+#pragma once
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <optional>
+#include <span>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include "mapped.hpp"
+
+// `removed` lines starting at `lineid` were replaced by `added` lines,
+// taking the buffer to `version`. an in-place change to a single line is
+// recorded as {lineid, 1, 1}.
+struct edit {
+    enum class kind : std::uint8_t {
+        edited, // by the user, an undo or an extension
+        loaded, // lines of the file arriving, which leaves it unmodified
+    };
+
+    int lineid;
+    int removed;
+    int added;
+    kind what = kind::edited;
+    long version = 0;
+};
+
+// a stretch of lines frozen at some version: copies of edited lines, or a
+// run of a mapped file or block that is only pointed at
+struct chunk {
+    std::vector<std::string> owned;
+    std::shared_ptr<const MappedFile> file; // set for a run
+    std::size_t first = 0;                  // first line of the run
+    int count = 0;
+    // the run's slice of the line table, taken while a loader may still
+    // be growing the file's own. empty once the file is fully indexed.
+    const char *base = nullptr;
+    std::vector<std::size_t> starts;
+
+    int size() const {
+        return file ? count : static_cast<int>(owned.size());
+    }
+
+    std::string_view line(int which) const {
+        if (!file)
+            return owned[which];
+        if (starts.empty())
+            return file->line(first + which);
+        const std::size_t begin = starts[which] - starts.front();
+        std::size_t end = starts[which + 1] - 1 - starts.front();
+        if (end > begin && base[end - 1] == '\r')
+            end--;
+        return {base + begin, end - begin};
+    }
+};
+
+// the whole buffer as it was at one version. nothing in it ever changes, so
+// it can be read from any thread without the editor lock. consecutive
+// snapshots share every chunk no edit touched in between, so taking one
+// costs about the size of the edits rather than the size of the buffer.
+class Snapshot {
+  private:
+    friend class Editor;
+
+    long revision = 0;
+    std::vector<std::shared_ptr<const chunk>> chunks;
+    std::vector<int> firsts; // first line of each chunk, then the line count
+    long logbase = 0;        // as in the editor, for changes_since()
+    std::shared_ptr<const edit[]> log; // the editor's, read up to revision
+
+    // puts the chunks in order once they are all in
+    void index() {
+        firsts.clear();
+        firsts.reserve(chunks.size() + 1);
+        int at = 0;
+        for (const auto &c : chunks) {
+            firsts.push_back(at);
+            at += c->size();
+        }
+        firsts.push_back(at);
+    }
+
+    // chunks of this snapshot that `edits` left alone, each with the line
+    // it starts on afterwards
+    std::vector<std::pair<int, std::shared_ptr<const chunk>>>
+    survivors(std::span<const edit> edits) const {
+        // new lines [to, to + count) are old lines [from, from + count)
+        struct same {
+            int to;
+            int from;
+            int count;
+        };
+        std::vector<same> runs{{0, 0, lines()}};
+        std::vector<same> next;
+        for (const edit &e : edits) {
+            next.clear();
+            const int end = e.lineid + e.removed;
+            const int shift = e.added - e.removed;
+            for (const same &s : runs) {
+                if (s.to < e.lineid)
+                    next.push_back(
+                        {s.to, s.from, std::min(s.count, e.lineid - s.to)});
+                if (s.to + s.count > end) {
+                    const int skip = std::max(0, end - s.to);
+                    next.push_back(
+                        {s.to + skip + shift, s.from + skip, s.count - skip});
+                }
+            }
+            runs.swap(next);
+        }
+
+        std::vector<std::pair<int, std::shared_ptr<const chunk>>> kept;
+        std::size_t r = 0;
+        for (std::size_t i = 0; i < chunks.size(); i++) {
+            const int first = firsts[i];
+            const int last = firsts[i + 1];
+            while (r < runs.size() && runs[r].from + runs[r].count <= first)
+                r++;
+            if (r == runs.size())
+                break;
+            if (first != last && runs[r].from <= first &&
+                last <= runs[r].from + runs[r].count)
+                kept.emplace_back(runs[r].to + (first - runs[r].from),
+                                  chunks[i]);
+        }
+        return kept;
+    }
+
+  public:
+    long version() const { return revision; }
+    int lines() const { return firsts.empty() ? 0 : firsts.back(); }
+
+    std::string_view line(int index) const {
+        const std::size_t at = static_cast<std::size_t>(
+            std::upper_bound(firsts.begin(), firsts.end() - 1, index) -
+            firsts.begin() - 1);
+        return chunks[at]->line(index - firsts[at]);
+    }
+
+    // walks the text of each line in order from `from`, stopping once `fn`
+    // returns false
+    template <typename Fn> void visit_lines(int from, Fn &&fn) const {
+        if (from < 0 || from >= lines())
+            return;
+        std::size_t at = static_cast<std::size_t>(
+            std::upper_bound(firsts.begin(), firsts.end() - 1, from) -
+            firsts.begin() - 1);
+        for (int skip = from - firsts[at]; at < chunks.size(); at++, skip = 0) {
+            const chunk &c = *chunks[at];
+            for (int i = skip; i < c.size(); i++) {
+                if (!fn(c.line(i)))
+                    return;
+            }
+        }
+    }
+
+    // every line, joined by '\n'
+    std::string text() const {
+        std::string out;
+        bool first = true;
+        visit_lines(0, [&](std::string_view chars) {
+            if (!first)
+                out.push_back('\n');
+            first = false;
+            out.append(chars);
+            return true;
+        });
+        return out;
+    }
+
+    // edits between version `since` and this snapshot, oldest first.
+    // nullopt means they are no longer known and the reader has to start
+    // over from this snapshot.
+    std::optional<std::span<const edit>> changes_since(long since) const {
+        if (since < logbase || since > revision)
+            return std::nullopt;
+        return std::span<const edit>(
+            log.get() + (since - logbase),
+            static_cast<std::size_t>(revision - since));
+    }
+};
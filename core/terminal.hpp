@@ -2,9 +2,14 @@
 
 #pragma once
 
+#include <algorithm>
 #include <cstdio>
+#include <deque>
 #include <errno.h>
 #include <fcntl.h>
+#include <functional>
+#include <memory>
+#include <poll.h>
 #include <stdarg.h>
 #include <stdexcept>
 #include <stdio.h>
@@ -40,6 +45,8 @@ enum Key {
     PAGEUP,
     PAGEDOWN,
     ESC,
+    PASTE,     // a bracketed paste came in whole, see Terminal::pasted()
+    MULTIBYTE, // a character of more than one byte, see Terminal::typed()
 };
 
 #define ENTERALTBUF "\x1b[?1049h"
@@ -52,6 +59,9 @@ enum Key {
 #define CLEARLINE "\x1b[K"     // size 3
 #define HIDECURSOR "\x1b[?25l" // size 6
 #define SHOWCURSOR "\x1b[?25h" // size 6
+#define PASTEON "\x1b[?2004h"   // size 8
+#define PASTEOFF "\x1b[?2004l"  // size 8
+#define PASTEEND "\x1b[201~"
 
 namespace {
 
@@ -68,42 +78,41 @@ class cursor_command {
 
 } // namespace
 
-class Terminal {
-  private:
-    thing winsize;
-    struct termios original;
-    std::string out;
-
+// where a terminal's bytes come from and go to. the tty is the real one; a
+// headless backend keeps everything in memory, so the ui can run without a
+// terminal for replays and benchmarks.
+class Backend {
   public:
-    Terminal &append(std::string_view content) {
-        out.append(content);
-        return *this;
-    }
-
-    Terminal &flush_buffer() {
-        if (!out.empty()) {
-            write(STDOUT_FILENO, out.data(), out.size());
-            out.clear();
-        }
-        return *this;
-    }
+    virtual ~Backend() = default;
+    // whatever input has arrived, up to `max` bytes, waiting up to the read
+    // timeout. 0 if nothing came, -1 on error.
+    virtual ssize_t read(char *into, std::size_t max) = 0;
+    virtual void write(std::string_view bytes) = 0;
+    // waits up to `timeout` ms (forever if negative) for input to arrive
+    virtual bool wait(int timeout) = 0;
+    // the window size, {-1, 0} if it can't be found
+    virtual thing size() = 0;
+    virtual bool raw(bool on) = 0;
+    // what to poll for input, -1 if there is nothing to poll
+    virtual int input() const { return -1; }
+};
 
-    Terminal &operator<<(Terminal &(*manip)(Terminal &)) {
-        return manip(*this);
-    }
+class TtyBackend final : public Backend {
+  private:
+    struct termios original;
 
-    struct thing find_cursor() {
+    thing find_cursor() {
         char seq[32];
         unsigned int index = 0;
         struct thing pos;
 
-        if (write(STDOUT_FILENO, "\x1b[999C\x1b[999B", 12) != 12)
+        if (::write(STDOUT_FILENO, "\x1b[999C\x1b[999B", 12) != 12)
             return {-1, 0};
-        if (write(STDOUT_FILENO, "\x1b[6n", 4) != 4)
+        if (::write(STDOUT_FILENO, "\x1b[6n", 4) != 4)
             return {-1, 0};
 
         while (index < sizeof(seq) - 1) {
-            if (read(STDIN_FILENO, &seq[index], 1) != 1)
+            if (::read(STDIN_FILENO, &seq[index], 1) != 1)
                 break;
             if (seq[index] == 'R')
                 break;
@@ -119,39 +128,37 @@ class Terminal {
         return pos;
     }
 
-    Terminal() {
+  public:
+    TtyBackend() {
         if (tcgetattr(STDIN_FILENO, &original) == -1)
-            crash("tcgettattr");
-        struct winsize win;
-
-        if (ioctl(STDOUT_FILENO, TIOCGWINSZ, &win) == -1 || win.ws_col == 0) {
-            winsize = find_cursor();
-        } else {
-            winsize.x = win.ws_col;
-            winsize.y = win.ws_row;
-        }
+            throw std::runtime_error("tcgettattr");
     }
 
-    struct thing window_size() { return winsize; }
+    ssize_t read(char *into, std::size_t max) override {
+        return ::read(STDIN_FILENO, into, max);
+    }
 
-    void update_winsize() {
-        struct winsize win;
+    void write(std::string_view bytes) override {
+        [[maybe_unused]] auto ignored =
+            ::write(STDOUT_FILENO, bytes.data(), bytes.size());
+    }
 
-        if (ioctl(STDOUT_FILENO, TIOCGWINSZ, &win) == -1 || win.ws_col == 0) {
-            winsize = find_cursor();
-        } else {
-            winsize.x = win.ws_col;
-            winsize.y = win.ws_row;
-        }
+    bool wait(int timeout) override {
+        struct pollfd fd = {STDIN_FILENO, POLLIN, 0};
+        return poll(&fd, 1, timeout) > 0;
     }
 
-    void disable_raw() {
-        write(STDOUT_FILENO, LEAVEALTBUF, 8);
-        if (tcsetattr(STDIN_FILENO, TCSAFLUSH, &original) == -1)
-            crash("tcsetattr");
+    thing size() override {
+        struct winsize win;
+        if (ioctl(STDOUT_FILENO, TIOCGWINSZ, &win) == -1 || win.ws_col == 0)
+            return find_cursor();
+        return {win.ws_col, win.ws_row};
     }
 
-    void enable_raw() {
+    bool raw(bool on) override {
+        if (!on)
+            return tcsetattr(STDIN_FILENO, TCSAFLUSH, &original) != -1;
+
         struct termios newterm = original;
         newterm.c_iflag &= ~(ICRNL | IXON | INPCK | ISTRIP | IXON);
         newterm.c_oflag &= ~(OPOST); // disable output processing
@@ -167,29 +174,220 @@ class Terminal {
             1; // maximum amount of time to wait before read
                // returns (in deciseconds), or the read timeout
 
-        if (tcsetattr(STDIN_FILENO, TCSAFLUSH, &newterm) == -1)
+        return tcsetattr(STDIN_FILENO, TCSAFLUSH, &newterm) != -1;
+    }
+
+    int input() const override { return STDIN_FILENO; }
+};
+
+// a terminal of a fixed size that only exists in memory. input is queued up
+// front a read at a time and handed out one read per advance(), the way it
+// arrived; output is counted and thrown away.
+class HeadlessBackend final : public Backend {
+  private:
+    thing dims;
+    std::deque<std::string> queued;
+    std::string ready; // handed out by read()
+    std::size_t taken = 0;
+    std::size_t written = 0;
+
+  public:
+    // called when something waits for input and none is ready, e.g. a
+    // prompt wanting its next key. returns whether it queued any.
+    std::function<bool()> starved;
+
+    explicit HeadlessBackend(thing dims = {80, 24}) : dims(dims) {}
+
+    void queue(std::string bytes) { queued.push_back(std::move(bytes)); }
+
+    // makes the next queued read available, false once there are none
+    bool advance() {
+        if (queued.empty())
+            return false;
+        ready.erase(0, taken);
+        taken = 0;
+        ready += queued.front();
+        queued.pop_front();
+        return true;
+    }
+
+    void resize(thing to) { dims = to; }
+    std::size_t output() const { return written; }
+
+    ssize_t read(char *into, std::size_t max) override {
+        const std::size_t n = std::min(max, ready.size() - taken);
+        ready.copy(into, n, taken);
+        taken += n;
+        return static_cast<ssize_t>(n);
+    }
+
+    void write(std::string_view bytes) override { written += bytes.size(); }
+
+    bool wait(int) override {
+        if (taken < ready.size())
+            return true;
+        if (queued.empty() && !(starved && starved()))
+            return false;
+        return advance();
+    }
+
+    thing size() override { return dims; }
+    bool raw(bool) override { return true; }
+};
+
+class Terminal {
+  private:
+    std::shared_ptr<Backend> backend;
+    thing winsize;
+    std::string out;
+
+    // input is read in blocks and handed out from here, so a burst of keys
+    // or a paste costs a few reads rather than one per byte
+    std::string in;
+    std::size_t taken = 0;
+    std::string paste;
+    std::string multibyte;
+
+    static constexpr std::size_t BLOCK = 64 << 10;
+
+    // reads whatever has arrived, waiting up to the read timeout. false if
+    // nothing came.
+    bool fill() {
+        if (taken == in.size()) {
+            in.clear();
+            taken = 0;
+        } else if (taken > BLOCK) {
+            in.erase(0, taken);
+            taken = 0;
+        }
+        const std::size_t had = in.size();
+        in.resize(had + BLOCK);
+        const ssize_t got = backend->read(in.data() + had, BLOCK);
+        in.resize(had + static_cast<std::size_t>(std::max<ssize_t>(got, 0)));
+        if (got == -1 && errno != EAGAIN) {
+            disable_raw();
+            die("read");
+        }
+        return got > 0;
+    }
+
+    bool next(char &c) {
+        if (taken == in.size() && !fill())
+            return false;
+        c = in[taken++];
+        return true;
+    }
+
+    // everything up to the end marker of a bracketed paste, with the '\r'
+    // terminals send for newlines turned into '\n'
+    void read_paste() {
+        paste.clear();
+        const std::string_view end = PASTEEND;
+        int idle = 0;
+        std::size_t found;
+        while ((found = in.find(end, taken)) == std::string::npos) {
+            // keep all but a possible partial marker, then wait for more
+            const std::size_t keep =
+                std::min(in.size() - taken, end.size() - 1);
+            paste.append(in, taken, in.size() - taken - keep);
+            taken = in.size() - keep;
+            if (fill())
+                idle = 0;
+            else if (++idle == 10) // the marker got lost, give up on it
+                break;
+        }
+        const std::size_t stop = found == std::string::npos ? in.size() : found;
+        paste.append(in, taken, stop - taken);
+        taken = found == std::string::npos ? in.size() : found + end.size();
+
+        std::size_t w = 0;
+        for (std::size_t r = 0; r < paste.size(); r++) {
+            if (paste[r] == '\r') {
+                paste[w++] = '\n';
+                if (r + 1 < paste.size() && paste[r + 1] == '\n')
+                    r++;
+            } else {
+                paste[w++] = paste[r];
+            }
+        }
+        paste.resize(w);
+    }
+
+  public:
+    Terminal &append(std::string_view content) {
+        out.append(content);
+        return *this;
+    }
+
+    Terminal &flush_buffer() {
+        if (!out.empty()) {
+            backend->write(out);
+            out.clear();
+        }
+        return *this;
+    }
+
+    Terminal &operator<<(Terminal &(*manip)(Terminal &)) {
+        return manip(*this);
+    }
+
+    explicit Terminal(std::shared_ptr<Backend> backend =
+                          std::make_shared<TtyBackend>())
+        : backend(std::move(backend)) {
+        winsize = this->backend->size();
+    }
+
+    struct thing window_size() { return winsize; }
+
+    void update_winsize() { winsize = backend->size(); }
+
+    // what to poll for keys, -1 for a terminal with nothing to poll
+    int input() const { return backend->input(); }
+
+    void disable_raw() {
+        backend->write(PASTEOFF);
+        backend->write(LEAVEALTBUF);
+        if (!backend->raw(false))
+            crash("tcsetattr");
+    }
+
+    void enable_raw() {
+        if (!backend->raw(true))
             die("tcsettattr");
+
+        // pastes arrive wrapped in markers instead of as typed keys
+        backend->write(PASTEON);
     }
 
+    // waits up to `timeout` ms (forever if negative) for input to arrive
+    bool key_ready(int timeout) {
+        if (buffered())
+            return true;
+        return backend->wait(timeout);
+    }
+
+    // whether keys are already read and waiting
+    bool buffered() const { return taken < in.size(); }
+
+    // the text of the last PASTE
+    const std::string &pasted() const { return paste; }
+
+    // the bytes of the last MULTIBYTE
+    const std::string &typed() const { return multibyte; }
+
     echar read_key() {
-        int int_read;
         char char_read;
+        while (!next(char_read)) {
+        }
 
         // processing escape sequences
 
-        while ((int_read = read(STDIN_FILENO, &char_read, 1)) != 1) {
-            if (int_read == -1 && errno != EAGAIN) {
-                disable_raw();
-                die("read");
-            }
-        }
-
         if (char_read == '\x1b') {
-            char sequence[3];
+            char sequence[2];
 
-            if (read(STDIN_FILENO, &sequence[0], 1) != 1)
+            if (!next(sequence[0]))
                 return '\x1b';
-            if (read(STDIN_FILENO, &sequence[1], 1) != 1)
+            if (!next(sequence[1]))
                 return '\x1b';
             // if an escape character is read, read two (or more) bytes into the
             // sequence buffer. If either times out, Esc was just pressed and
@@ -197,29 +395,38 @@ class Terminal {
 
             if (sequence[0] == '[') {
                 if (sequence[1] >= '0' && sequence[1] <= '9') {
-                    if (read(STDIN_FILENO, &sequence[2], 1) != 1)
+                    // a number then '~': 5 or 6 is page up or page down,
+                    // 200 starts a bracketed paste
+                    int code = sequence[1] - '0';
+                    char c;
+                    while (true) {
+                        if (!next(c))
+                            return '\x1b';
+                        if (c < '0' || c > '9')
+                            break;
+                        code = code * 10 + (c - '0');
+                    }
+                    if (c != '~')
                         return '\x1b';
 
-                    if (sequence[2] ==
-                        '~') { // if the byte after [ is a digit, we read
-                               // another byte, which should be ~. 5 or 6
-                               // corresponds to page up or page down
-                        switch (sequence[1]) {
-                        case '1':
-                            return HOME;
-                        case '3':
-                            return DEL;
-                        case '4':
-                            return END;
-                        case '5':
-                            return PAGEUP;
-                        case '6':
-                            return PAGEDOWN;
-                        case '7':
-                            return HOME;
-                        case '8':
-                            return END;
-                        }
+                    switch (code) {
+                    case 1:
+                        return HOME;
+                    case 3:
+                        return DEL;
+                    case 4:
+                        return END;
+                    case 5:
+                        return PAGEUP;
+                    case 6:
+                        return PAGEDOWN;
+                    case 7:
+                        return HOME;
+                    case 8:
+                        return END;
+                    case 200:
+                        read_paste();
+                        return PASTE;
                     }
                 } else {
                     switch (sequence[1]) {
@@ -251,20 +458,37 @@ class Terminal {
             }
         }
 
-        return char_read;
+        // a utf-8 lead byte and what follows it make one key
+        const auto lead = static_cast<unsigned char>(char_read);
+        if (lead >= 0xc2 && lead <= 0xf4) {
+            const int length = lead < 0xe0 ? 2 : lead < 0xf0 ? 3 : 4;
+            multibyte.assign(1, char_read);
+            char c;
+            while (static_cast<int>(multibyte.size()) < length && next(c)) {
+                if ((c & 0xc0) != 0x80) {
+                    taken--; // not part of it, so left for the next key
+                    break;
+                }
+                multibyte.push_back(c);
+            }
+            if (static_cast<int>(multibyte.size()) == length)
+                return MULTIBYTE;
+        }
+
+        return lead;
     }
 
     void crash(const std::string reason) {
-        write(STDOUT_FILENO, CLEARSCREEN, 4);
-        write(STDOUT_FILENO, RESETCURSOR, 3);
-        write(STDOUT_FILENO, LEAVEALTBUF, 7);
+        backend->write(CLEARSCREEN);
+        backend->write(RESETCURSOR);
+        backend->write(LEAVEALTBUF);
         throw std::runtime_error(reason);
     }
 
     void die(const std::string reason) {
-        write(STDOUT_FILENO, CLEARSCREEN, 4);
-        write(STDOUT_FILENO, RESETCURSOR, 3);
-        write(STDOUT_FILENO, LEAVEALTBUF, 7);
+        backend->write(CLEARSCREEN);
+        backend->write(RESETCURSOR);
+        backend->write(LEAVEALTBUF);
         disable_raw();
         throw std::runtime_error(reason);
     }
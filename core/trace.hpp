@@ -0,0 +1,214 @@
+// keystroke traces
+
+#pragma once
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <fstream>
+#include <memory>
+#include <sstream>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include "terminal.hpp"
+#include "tui.hpp"
+
+// a trace is what a session read from its terminal and when, a line per read
+// or resize:
+//
+//   <microseconds in> k <the bytes read, in hex>
+//   <microseconds in> r <columns> <rows>
+//
+// it starts with the window size the session started at.
+namespace trace {
+
+using clock = std::chrono::steady_clock;
+
+struct record {
+    std::chrono::microseconds at{};
+    std::string keys; // empty for a resize
+    thing size{0, 0};
+};
+
+inline std::vector<record> load(const std::string &path) {
+    std::ifstream in(path);
+    if (!in)
+        throw std::runtime_error("can't read trace " + path);
+
+    std::vector<record> records;
+    std::string text;
+    for (int number = 1; std::getline(in, text); number++) {
+        if (text.empty() || text[0] == '#')
+            continue;
+        std::istringstream fields(text);
+        long long at;
+        char kind;
+        record r;
+        bool ok = static_cast<bool>(fields >> at >> kind);
+        r.at = std::chrono::microseconds{at};
+        if (ok && kind == 'r') {
+            ok = static_cast<bool>(fields >> r.size.x >> r.size.y);
+        } else if (ok && kind == 'k') {
+            std::string hex;
+            ok = fields >> hex && !hex.empty() && hex.size() % 2 == 0;
+            for (std::size_t i = 0; ok && i < hex.size(); i += 2) {
+                const int byte = std::stoi(hex.substr(i, 2), nullptr, 16);
+                r.keys.push_back(static_cast<char>(byte));
+            }
+        } else {
+            ok = false;
+        }
+        if (!ok)
+            throw std::runtime_error(path + ":" + std::to_string(number) +
+                                     ": not a trace line");
+        records.push_back(std::move(r));
+    }
+    return records;
+}
+
+// passes everything through to `inner`, writing down each read and each new
+// window size on the way. lines are flushed as they go, so a session that
+// crashes still leaves its trace.
+class Recorder final : public Backend {
+  private:
+    std::shared_ptr<Backend> inner;
+    std::ofstream out;
+    clock::time_point start = clock::now();
+    thing last{0, 0};
+
+    long long now() const {
+        return std::chrono::duration_cast<std::chrono::microseconds>(
+                   clock::now() - start)
+            .count();
+    }
+
+  public:
+    Recorder(std::shared_ptr<Backend> inner, const std::string &path)
+        : inner(std::move(inner)), out(path, std::ios::trunc) {
+        if (!out)
+            throw std::runtime_error("can't write trace " + path);
+    }
+
+    ssize_t read(char *into, std::size_t max) override {
+        const ssize_t got = inner->read(into, max);
+        if (got > 0) {
+            static constexpr char digits[] = "0123456789abcdef";
+            std::string hex;
+            hex.reserve(static_cast<std::size_t>(got) * 2);
+            for (ssize_t i = 0; i < got; i++) {
+                const auto byte = static_cast<unsigned char>(into[i]);
+                hex.push_back(digits[byte >> 4]);
+                hex.push_back(digits[byte & 0xf]);
+            }
+            out << now() << " k " << hex << '\n' << std::flush;
+        }
+        return got;
+    }
+
+    void write(std::string_view bytes) override { inner->write(bytes); }
+    bool wait(int timeout) override { return inner->wait(timeout); }
+
+    thing size() override {
+        const thing current = inner->size();
+        if (current.x != last.x || current.y != last.y) {
+            out << now() << " r " << current.x << ' ' << current.y << '\n'
+                << std::flush;
+            last = current;
+        }
+        return current;
+    }
+
+    bool raw(bool on) override { return inner->raw(on); }
+    int input() const override { return inner->input(); }
+};
+
+// how a replay went
+struct result {
+    std::vector<clock::duration> took; // one per key read the ui handled
+    std::size_t reads = 0; // also counting those a prompt took mid-key
+    std::size_t bytes = 0; // written to the terminal for those keys
+
+    // the `p`th percentile (0 to 100) of `took`, by nearest rank
+    clock::duration percentile(double p) const {
+        if (took.empty())
+            return {};
+        std::vector<clock::duration> sorted = took;
+        std::sort(sorted.begin(), sorted.end());
+        const auto rank = static_cast<std::size_t>(
+            std::ceil(p / 100 * static_cast<double>(sorted.size())));
+        return sorted[std::clamp<std::size_t>(rank, 1, sorted.size()) - 1];
+    }
+
+    std::string summary() const {
+        auto us = [](clock::duration d) {
+            return std::chrono::duration<double, std::micro>(d).count();
+        };
+        char text[256];
+        std::snprintf(
+            text, sizeof(text),
+            "%zu keystrokes (%zu reads): p50 %.1f us, p99 %.1f us, max %.1f "
+            "us, %zu bytes out (%.0f a keystroke)",
+            took.size(), reads, us(percentile(50)), us(percentile(99)),
+            us(percentile(100)), bytes,
+            took.empty() ? 0.0
+                         : static_cast<double>(bytes) /
+                               static_cast<double>(took.size()));
+        return text;
+    }
+};
+
+// feeds `records` through the ui a read at a time, as fast as it goes, each
+// handled and drawn before the next. keys a prompt reads while open count
+// toward the key that opened it. the ^Q that ended the session is where the
+// replay stops, since quitting exits.
+inline result replay(const std::vector<record> &records, TUI &ui,
+                     HeadlessBackend &terminal) {
+    result out;
+    std::size_t next = 0;
+    bool resized = false;
+
+    // queues the next read, applying any resizes on the way
+    auto feed = [&] {
+        for (; next < records.size(); next++) {
+            const record &r = records[next];
+            if (r.keys.empty()) {
+                terminal.resize(r.size);
+                resized = true;
+                continue;
+            }
+            if (r.keys.find(static_cast<char>(CONTROL('q'))) !=
+                std::string::npos)
+                return false;
+            terminal.queue(r.keys);
+            next++;
+            out.reads++;
+            return true;
+        }
+        return false;
+    };
+    terminal.starved = feed;
+
+    ui.draw_screen();
+    while (feed()) {
+        if (resized) {
+            ui.resize();
+            ui.draw_screen();
+            resized = false;
+        }
+        terminal.advance();
+        const std::size_t before = terminal.output();
+        const auto start = clock::now();
+        ui.receive_input();
+        ui.draw_screen();
+        out.took.push_back(clock::now() - start);
+        out.bytes += terminal.output() - before;
+    }
+    terminal.starved = nullptr;
+    return out;
+}
+
+} // namespace trace
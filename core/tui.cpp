@@ -1,106 +1,164 @@
 #include "tui.hpp"
 #include <algorithm>
+#include <cctype>
+#include <charconv>
 #include <ctype.h>
-#include <errno.h>
 #include <filesystem>
-#include <fstream>
 #include <iostream>
 #include <memory>
 #include <stdexcept>
 
 void TUI::register_extension(std::unique_ptr<Extension> extension) {
-    extensions.emplace_back(std::move(extension));
+    if (extensions.empty())
+        published = shown->editor.version();
+    extensions.push_back(std::make_unique<ExtensionHost>(
+        workspace, *this, events, std::move(extension)));
 }
 
 void TUI::update_index() {
-    index.clear();
-    if (view_size.x <= 0 || editor.numlines() == 0) {
+    Latency::span timing(latency, Latency::index);
+    if (view_size.x <= 0 || shown->editor.numlines() == 0) {
+        shown->index.clear();
+        shown->indexed_width = view_size.x;
+        shown->indexed_version = shown->editor.version();
         return;
     }
 
-    for (int lineid = 0; lineid < editor.numlines(); lineid++) {
-        Line &at = editor.line_at(lineid);
-        const int length = at.length();
+    auto edits = shown->editor.edits_since(shown->indexed_version);
+    if (!edits || view_size.x != shown->indexed_width) {
+        std::vector<int> rowcounts;
+        rowcounts.reserve(shown->editor.numlines());
+        shown->editor.visit_lines(0, [&](std::string_view chars) {
+            rowcounts.push_back(wrapped_rows(chars, view_size.x));
+            return true;
+        });
+        shown->index.assign(rowcounts);
+        shown->indexed_width = view_size.x;
+        shown->indexed_version = shown->editor.version();
+        return;
+    }
 
-        if (length == 0) {
-            index.push_back({lineid, 0, 0}); // empty lines still occupy a row
-            continue;
+    // replay the structure of each edit first, then re-wrap the lines they
+    // left behind once every line id has settled into its final position
+    std::vector<std::pair<int, int>> touched;
+    for (const edit &e : *edits) {
+        shown->index.erase(e.lineid, e.removed);
+        shown->index.insert(e.lineid, e.added, 1);
+
+        std::vector<std::pair<int, int>> shifted;
+        const int gone = e.lineid + e.removed;
+        const int shift = e.added - e.removed;
+        for (auto [first, last] : touched) {
+            if (first < e.lineid)
+                shifted.push_back({first, std::min(last, e.lineid)});
+            if (last > gone)
+                shifted.push_back({std::max(first, gone) + shift, last + shift});
         }
+        shifted.push_back({e.lineid, e.lineid + e.added});
+        touched = std::move(shifted);
+    }
 
-        for (int charid = 0; charid < length; charid += view_size.x) {
-            const int width = std::min(view_size.x, length - charid);
-            index.push_back({lineid, charid, width});
-        }
+    for (auto [first, last] : touched) {
+        last = std::min(last, shown->editor.numlines());
+        if (first >= last)
+            continue;
+        std::vector<int> rowcounts;
+        rowcounts.reserve(last - first);
+        shown->editor.visit_lines(first, [&](std::string_view chars) {
+            rowcounts.push_back(wrapped_rows(chars, view_size.x));
+            return static_cast<int>(rowcounts.size()) < last - first;
+        });
+        shown->index.replace(first, rowcounts);
+    }
+    shown->indexed_version = shown->editor.version();
 
-        if (length % view_size.x == 0) {
-            index.push_back({lineid, length, 0});
-        }
+    if (shown->index.lines() != shown->editor.numlines()) {
+        // out of step somehow, rebuild from scratch
+        shown->indexed_version = -1;
+        update_index();
     }
 }
 
-int TUI::filled_rows() { return static_cast<int>(index.size()); }
+int TUI::filled_rows() { return shown->index.rows(); }
 
-TUI::rowindex &TUI::row_at(int abs_y) {
-    if (index.empty()) {
+TUI::rowindex TUI::row_at(int abs_y) {
+    if (shown->index.empty()) {
         throw std::runtime_error("row_at(): no rows to reference!");
     }
     int loc = std::clamp(abs_y, 0, filled_rows() - 1);
-    return index.at(loc);
+    auto [lineid, nth] = shown->index.locate(loc);
+    const int rows = shown->index.rows_of(lineid);
+    if (rows == 1)
+        return {lineid, 0, std::min(shown->editor.width_at(lineid),
+                                    view_size.x), 0};
+    // a wide character can end a row a column early, so the rows of a
+    // wrapped line start wherever its walk found them
+    const wrapping &wrapped =
+        shown->renders.wrapped(shown->editor, lineid, view_size.x);
+    const int charid = wrapped.start(nth);
+    const int end =
+        nth + 1 < rows ? wrapped.start(nth + 1) : wrapped.length;
+    const int width = std::clamp(end - charid, 0, view_size.x);
+    return {lineid, charid, width, nth};
 }
 
 int TUI::get_width(int row) {
     if (row < 0 || row >= filled_rows())
         return 0;
-    const rowindex &targetrow = row_at(row);
-    Line &corline = editor.line_at(targetrow.lineid);
-    const int width = std::max(0, corline.length() - targetrow.charid);
-    index[row].width = std::min(width, view_size.x);
-    return index[row].width;
-
-    // gets the live width instead of a cached width inside of the index.
+    return row_at(row).width;
+}
+int TUI::find_width(int row) { return row_at(row).width; }
+
+// columns the cursor moves over to step past what it is on in `row`: two for
+// a wide character, one for anything else, tabs too
+int TUI::step_width(int row) {
+    const rowindex at = row_at(row);
+    if (shown->renders.wrapped(shown->editor, at.lineid, view_size.x).narrow)
+        return 1;
+    const std::string_view chars = shown->editor.chars_at(at.lineid);
+    const std::size_t cx =
+        static_cast<std::size_t>(char_at_rx(chars, at.charid + cursor.x));
+    if (cx >= chars.size() || chars[cx] == '\t')
+        return 1;
+    const std::size_t next = utf8::next(chars, cx);
+    return std::max(1, utf8::columns(chars.substr(cx, next - cx)));
 }
-int TUI::find_width(int row) { return index[row].width; }
 
-int TUI::absy() { return cursor.y + view_offset.y; }
-int TUI::absy(int y) { return y + view_offset.y; }
+int TUI::absy() { return cursor.y + shown->view_offset.y; }
+int TUI::absy(int y) { return y + shown->view_offset.y; }
 
 int TUI::get_charid() {
-    if (index.empty())
+    if (shown->index.empty())
         return 0;
     return row_at(absy()).charid + cursor.x;
 }
 
 void TUI::cursor_findloc(int lineid, int charid) {
     update_index();
-    if (index.empty())
+    if (shown->index.empty())
         return;
 
-    int targetrowid = 0;
-    for (int i = 0; i < filled_rows(); i++) {
-        struct rowindex &entry = row_at(i);
-        if (entry.lineid != lineid)
-            continue;
-
-        const int width = get_width(i);
-        const int rowstart = entry.charid;
-        const int rowend = rowstart + width;
-        const bool lastrow =
-            (i + 1 >= filled_rows()) || (row_at(i + 1).lineid != lineid);
-
-        if (charid < rowend || (charid == rowend && lastrow)) {
-            targetrowid = i;
-            cursor.x = std::clamp(charid - rowstart, 0, width);
-            break;
-        }
-    }
-
-    if (targetrowid < view_offset.y)
-        view_offset.y = targetrowid;
+    lineid = std::clamp(lineid, 0, shown->index.lines() - 1);
+    const int rows = shown->index.rows_of(lineid);
+    const int nth =
+        rows == 1
+            ? 0
+            : std::clamp(shown->renders
+                             .wrapped(shown->editor, lineid, view_size.x)
+                             .row_of(charid),
+                         0, rows - 1);
+    const int targetrowid = shown->index.first_row(lineid) + nth;
+    const rowindex target = row_at(targetrowid);
+    cursor.x = std::clamp(charid - target.charid, 0, target.width);
+
+    if (targetrowid < shown->view_offset.y)
+        shown->view_offset.y = targetrowid;
     else if (targetrowid >= abs(view_size.y)) {
-        view_offset.y = targetrowid - view_size.y + 1;
+        shown->view_offset.y = targetrowid - view_size.y + 1;
     }
 
-    cursor.y = std::clamp(targetrowid - view_offset.y, 0, view_size.y - 1);
+    cursor.y =
+        std::clamp(targetrowid - shown->view_offset.y, 0, view_size.y - 1);
 }
 
 void TUI::scroll() {
@@ -108,51 +166,47 @@ void TUI::scroll() {
         return;
 
     if (cursor.y < 0) {
-        view_offset.y--;
+        shown->view_offset.y--;
     }
 
     if (cursor.y > view_size.y) {
-        view_offset.y++;
+        shown->view_offset.y++;
     }
 }
 
 void TUI::point_editor() {
-    if (index.empty()) {
-        if (editor.numlines() == 0)
-            editor.point(0, 0);
+    if (shown->index.empty()) {
+        if (shown->editor.numlines() == 0)
+            shown->editor.point(0, 0);
         return;
     }
 
-    const rowindex &currentrow = row_at(absy());
-    Line &currentline = editor.line_at(currentrow.lineid);
+    const rowindex currentrow = row_at(absy());
     const int rctarget = currentrow.charid + cursor.x;
-
-    int rx = 0, cx = 0;
-    while (cx < currentline.size()) {
-        char c = currentline.chars[cx];
-        int progress = 1;
-        if (c == '\t')
-            progress += (TAB_SIZE - 1) - (rx % TAB_SIZE);
-        if (rx + progress > rctarget)
-            break;
-        rx += progress;
-        cx++;
+    const std::string_view chars = shown->editor.chars_at(currentrow.lineid);
+    const int cx = char_at_rx(chars, rctarget);
+
+    // the cursor can't sit in the second column of a wide character
+    if (cx < static_cast<int>(chars.size()) && chars[cx] != '\t') {
+        const int start = render_x(chars, cx);
+        if (start < rctarget && start >= currentrow.charid)
+            cursor.x = start - currentrow.charid;
     }
 
-    editor.point(currentrow.lineid, cx);
+    shown->editor.point(currentrow.lineid, cx);
 }
 
 void TUI::move_cursor(echar key) {
     update_index();
-    if (index.empty()) {
-        view_offset.y = 0;
+    if (shown->index.empty()) {
+        shown->view_offset.y = 0;
         cursor = {0, 0};
         point_editor();
         return;
     }
 
-    view_offset.y =
-        std::clamp(view_offset.y, 0, std::max(0, filled_rows() - 1));
+    shown->view_offset.y =
+        std::clamp(shown->view_offset.y, 0, std::max(0, filled_rows() - 1));
 
     const int maxrow = filled_rows() - 1;
     const int originalrow = absy();
@@ -172,7 +226,7 @@ void TUI::move_cursor(echar key) {
         break;
     case RIGHTARROW:
         if (cursor.x < get_width(absy_temp)) {
-            cursor.x++;
+            cursor.x += step_width(absy_temp);
             if (cursor.x == find_width(absy_temp) &&
                 absy_temp + 1 < filled_rows()) {
                 absy_temp++;
@@ -203,17 +257,17 @@ void TUI::move_cursor(echar key) {
         break;
     }
 
-    if (absy_temp < view_offset.y)
-        view_offset.y = absy_temp;
-    else if (absy_temp >= view_offset.y + view_size.y)
-        view_offset.y = absy_temp - view_size.y + 1;
+    if (absy_temp < shown->view_offset.y)
+        shown->view_offset.y = absy_temp;
+    else if (absy_temp >= shown->view_offset.y + view_size.y)
+        shown->view_offset.y = absy_temp - view_size.y + 1;
 
-    cursor.y = absy_temp - view_offset.y;
+    cursor.y = absy_temp - shown->view_offset.y;
     cursor.x = std::clamp(cursor.x, 0, get_width(absy_temp));
     point_editor();
 }
 
-void TUI::print_welcomemsg() {
+void TUI::print_welcomemsg(std::string &row) {
     std::string msg = "Poop editor -- version " + VERSION;
     int msglen = static_cast<int>(msg.size());
 
@@ -222,112 +276,327 @@ void TUI::print_welcomemsg() {
 
     int padding = (view_size.x - msglen) / 2;
     if (padding) {
-        terminal.append("~");
+        row.append("~");
         padding--;
     }
-    while (padding--)
-        terminal.append(" ");
+    while (padding-- > 0)
+        row.append(" ");
 
-    terminal.append(msg);
+    row.append(msg);
 }
 
 void TUI::draw_rows() {
+    Latency::span timing(latency, Latency::rows);
+    int coloured = -1; // line whose colours are in linespans
     for (int viewrow = 0; viewrow < view_size.y; viewrow++) {
-        terminal << clearln;
-        // CLEARLINE clears from the cursor to the left,
-        // which may clear the last character of the column
-        // put it here to stop that from happening
+        std::string &row = back[viewrow].text;
 
         const int absrow = absy(viewrow);
         const bool coldopen = absrow >= filled_rows();
 
         if (coldopen) {
-            if (editor.numlines() == 0 && viewrow == view_size.y / 3) {
-                print_welcomemsg();
+            if (shown->editor.numlines() == 0 && viewrow == view_size.y / 3) {
+                print_welcomemsg(row);
             } else {
-                terminal.append("~");
+                row.append("~");
             }
         } else {
-            const rowindex &currentrow = index[absrow];
-            Line &currentline = editor.line_at(currentrow.lineid);
+            const rowindex currentrow = row_at(absrow);
 
-            const int width = get_width(absrow);
+            const int width = currentrow.width;
             if (width > 0) {
-                auto slice = std::string_view(currentline.render.data() +
-                                                  currentrow.charid,
-                                              static_cast<size_t>(width));
-                terminal.append(slice);
+                // the row's bytes come from the line's walk, done once for
+                // every row of it
+                const wrapping &wrapped = shown->renders.wrapped(
+                    shown->editor, currentrow.lineid, view_size.x);
+                const std::string_view rendered =
+                    shown->renders.get(shown->editor, currentrow.lineid);
+                const std::size_t from = wrapped.byte(currentrow.nth);
+                const std::size_t to = currentrow.nth + 1 < wrapped.rows()
+                                           ? wrapped.byte(currentrow.nth + 1)
+                                           : rendered.size();
+                row.append(rendered.substr(from, to - from));
+
+                if (coloured != currentrow.lineid) {
+                    shown->highlight.colour_line(
+                        shown->editor, currentrow.lineid, linespans);
+                    coloured = currentrow.lineid;
+                }
+                slice_spans(linespans, currentrow.charid, width,
+                            back[viewrow].spans);
             }
         }
-
-        terminal.append("\r\n");
     }
 }
 
 void TUI::draw_statusbar() {
-    terminal << invcolour;
-    const std::string filename =
-        editor.fileName.empty() ? "[ no name ]" : editor.fileName;
-    const std::string modified = editor.dirty() ? "[ modified ]" : "";
-    const std::string left = filename + " - " +
-                             std::to_string(editor.numlines()) + " lines " +
-                             modified;
+    frameline &bar = back[view_size.y];
+    bar.inverted = true;
+
+    std::string filename =
+        shown->editor.fileName.empty() ? "[ no name ]" : shown->editor.fileName;
+    if (workspace.size() > 1)
+        filename = "[" + std::to_string(workspace.position() + 1) + "/" +
+                   std::to_string(workspace.size()) + "] " + filename;
+    const std::string modified = shown->editor.dirty() ? "[ modified ]" : "";
+    const std::string loading =
+        shown->loader.loading()
+            ? "[ loading " + std::to_string(shown->loader.percent()) + "% ]"
+            : "";
+    const std::string saving = shown->saver.saving() ? "[ saving ]" : "";
+    const std::string left =
+        filename + " - " + std::to_string(shown->editor.numlines()) +
+        " lines " + modified + loading + saving;
     int leftlen =
-        static_cast<int>(left.size()); // this represents the entire left length
+        utf8::columns(left); // this represents the entire left length
 
-    const std::string right = std::to_string(editor.pointer_linepos() + 1) +
-                              "/" + std::to_string(editor.numlines());
+    const std::string right =
+        std::to_string(shown->editor.pointer_linepos() + 1) + "/" +
+        std::to_string(shown->editor.numlines());
     const int rightlen = static_cast<int>(right.size());
     // cursor position is 0 indexed
 
-    terminal.append(left.substr(0, std::min(leftlen, view_size.x)));
+    bar.text.append(left, 0, utf8::at_column(left, view_size.x));
 
     while (leftlen < view_size.x) {
         if (view_size.x - leftlen == rightlen) {
-            terminal.append(right);
+            bar.text.append(right);
             break;
         } else {
-            terminal.append(" ");
+            bar.text.append(" ");
             leftlen++;
         }
     }
-
-    terminal << normcolour;
-    terminal.append("\r\n");
 }
 
 void TUI::draw_msgbar() {
-    terminal << clearln;
+    std::string &row = back[view_size.y + 1].text;
+    if (latency_overlay) {
+        const std::string timings = latency.overlay();
+        row.append(timings, 0, std::max(0, view_size.x));
+        return;
+    }
     if (statusmsg.empty()) {
         return;
     }
 
-    if (std::chrono::steady_clock::now() - statusmsg_born > MSGLIF)
+    if (std::chrono::steady_clock::now() - statusmsg_born >= MSGLIF)
         return;
 
-    terminal.append(statusmsg.substr(
-        0, std::min(view_size.x, static_cast<int>(statusmsg.size()))));
+    row.append(statusmsg, 0, utf8::at_column(statusmsg, view_size.x));
+}
+
+void TUI::prefetch() {
+    // warm the lines half a screen either side, so scrolling onto them
+    // finds them already rendered
+    if (shown->index.empty())
+        return;
+    const int margin = view_size.y / 2;
+    const int top = row_at(shown->view_offset.y).lineid;
+    const int bottom = row_at(shown->view_offset.y + view_size.y).lineid;
+    const int first = std::max(0, top - margin);
+    const int last = std::min(shown->editor.numlines() - 1, bottom + margin);
+    for (int lineid = first; lineid < top; lineid++)
+        shown->renders.get(shown->editor, lineid);
+    for (int lineid = bottom + 1; lineid <= last; lineid++)
+        shown->renders.get(shown->editor, lineid);
+}
+
+void TUI::paint(const frameline &row, std::size_t from, std::size_t col) {
+    // one escape per change of colour, not per character. `from` is a byte
+    // of the text and `col` the column it is drawn at, the same for ascii.
+    const std::string_view text = row.text;
+    const char *end = text.data() + text.size();
+    colour_walk colours(row.spans);
+    colour current = colour::normal;
+    std::size_t run = from;
+    for (std::size_t at = from; at <= text.size();) {
+        int length = 1;
+        int width = 1;
+        if (at < text.size() && static_cast<unsigned char>(text[at]) >= 0x80) {
+            char32_t cp;
+            length = utf8::decode(text.data() + at, end, cp);
+            width = utf8::width(cp);
+        }
+        // marks take the colour of what they are on
+        const colour next = at == text.size() ? colour::normal
+                            : width == 0      ? current
+                                              : colours.at(col);
+        if (next != current || at == text.size()) {
+            terminal.append(text.substr(run, at - run));
+            if (next != current)
+                terminal.append(escape(next));
+            current = next;
+            run = at;
+        }
+        if (at == text.size())
+            break;
+        at += static_cast<std::size_t>(length);
+        col += static_cast<std::size_t>(width);
+    }
+}
+
+// whether a new screen cell starts at byte `at` of `text`, rather than the
+// rest of a character or a mark on the one before. a byte that isn't part
+// of a whole character is a cell of its own, as render_width() counts it.
+static bool cell_starts(std::string_view text, std::size_t at) {
+    if (at >= text.size())
+        return true;
+    if (static_cast<unsigned char>(text[at]) < 0x80)
+        return true;
+    const char *end = text.data() + text.size();
+    char32_t cp;
+    // inside a character that starts a few bytes back
+    for (std::size_t back = 1; back <= 3 && back <= at; back++) {
+        if (!utf8::continuation(text[at - back])) {
+            if (utf8::decode(&text[at - back], end, cp) >
+                static_cast<int>(back))
+                return false;
+            break;
+        }
+    }
+    utf8::decode(text.data() + at, end, cp);
+    return utf8::width(cp) != 0;
+}
+
+void TUI::present() {
+    // only rows that differ from what is already on screen get sent, and of
+    // those only the span between their common prefix and suffix, widened
+    // to whole characters
+    const int rows = static_cast<int>(back.size());
+    const bool resized = painted.x != view_size.x || painted.y != rows;
+    if (resized) {
+        terminal << clear_screen;
+        front.assign(rows, frameline{});
+        painted = {view_size.x, rows};
+    }
+
+    bool hidden = false;
+    for (int y = 0; y < rows; y++) {
+        const frameline &now = back[y];
+        const frameline &was = front[y];
+        if (now == was)
+            continue;
+
+        if (!hidden) {
+            terminal << hide_cursor;
+            hidden = true;
+        }
+
+        if (now.inverted || was.inverted) {
+            terminal << place_cursor(0, y) << clearln;
+            if (now.inverted)
+                terminal << invcolour;
+            terminal.append(now.text);
+            if (now.inverted)
+                terminal << normcolour;
+            continue;
+        }
+
+        const std::string_view text = now.text;
+        const std::string_view old = was.text;
+        std::size_t shared =
+            std::mismatch(text.begin(), text.end(), old.begin(), old.end())
+                .first -
+            text.begin();
+        while (shared > 0 &&
+               !(cell_starts(text, shared) && cell_starts(old, shared)))
+            shared--;
+        const bool ascii = utf8::ascii(text) && utf8::ascii(old);
+        const bool shorter = ascii ? text.size() < old.size()
+                                   : utf8::columns(text) < utf8::columns(old);
+
+        if (!now.spans.empty() || !was.spans.empty()) {
+            // coloured rows are redrawn from where either the text or the
+            // colours first differ
+            colour_walk a(now.spans), b(was.spans);
+            std::size_t from = 0;
+            std::size_t col = 0;
+            while (from < shared && a.at(col) == b.at(col)) {
+                const std::size_t next =
+                    ascii ? from + 1 : utf8::next(text, from);
+                col += ascii ? 1
+                             : static_cast<std::size_t>(utf8::columns(
+                                   text.substr(from, next - from)));
+                from = next;
+            }
+            terminal << place_cursor(static_cast<int>(col), y);
+            paint(now, from, col);
+            if (shorter)
+                terminal << clearln;
+            continue;
+        }
+
+        std::size_t end = text.size();
+        if (text.size() == old.size()) {
+            while (end > shared && text[end - 1] == old[end - 1])
+                end--;
+            while (end < text.size() &&
+                   !(cell_starts(text, end) && cell_starts(old, end)))
+                end++;
+            // the suffix only stays put if what changed kept its width
+            if (!ascii && utf8::columns(text.substr(shared, end - shared)) !=
+                              utf8::columns(old.substr(shared, end - shared)))
+                end = text.size();
+        }
+
+        const int col = ascii ? static_cast<int>(shared)
+                              : utf8::columns(text.substr(0, shared));
+        terminal << place_cursor(col, y);
+        terminal.append(text.substr(shared, end - shared));
+        if (shorter)
+            terminal << clearln;
+    }
+
+    if (hidden || cursor.x != painted_cursor.x ||
+        cursor.y != painted_cursor.y) {
+        terminal << place_cursor(cursor.x, cursor.y);
+        painted_cursor = cursor;
+    }
+    if (hidden)
+        terminal << show_cursor;
+    {
+        Latency::span timing(latency, Latency::flush);
+        terminal << send;
+    }
+
+    std::swap(front, back);
+}
+
+void TUI::redraw() { painted = {0, 0}; }
+
+void TUI::resize() {
+    terminal.update_winsize();
+    view_size = terminal.window_size();
+    view_size.y -= SBARHEIGHT;
+    stale = true;
 }
 
 void TUI::set_statusmsg(std::string msg) {
     statusmsg = std::move(msg);
     statusmsg_born = std::chrono::steady_clock::now();
+    // one timer at a time, however often the message changes. handle()
+    // pushes it back if the message was replaced in the meantime.
+    if (!statusmsg_expiry && !statusmsg.empty()) {
+        statusmsg_expiry = statusmsg_born + MSGLIF;
+        events.wake_at(*statusmsg_expiry);
+    }
 }
 
-std::optional<std::string> TUI::prompt(std::string msgleft,
-                                       std::optional<std::string> msgright) {
+std::optional<std::string>
+TUI::prompt(std::string msgleft, std::optional<std::string> msgright,
+            const std::function<void(const std::string &, echar)> &onkey) {
     std::string input;
     while (true) {
         set_statusmsg(msgleft + input + msgright.value_or(""));
         draw_screen();
 
-        echar c = terminal.read_key();
+        echar c = await_key();
         switch (c) {
         case CONTROL('h'):
         case BACKSPACE:
         case DEL:
-            if (!input.empty())
-                input.pop_back();
+            input.resize(utf8::previous(input, input.size()));
             break;
 
         case '\r':
@@ -342,40 +611,174 @@ std::optional<std::string> TUI::prompt(std::string msgleft,
             return std::nullopt;
             break;
 
+        case PASTE:
+            for (char p : terminal.pasted()) {
+                if (!iscntrl(static_cast<unsigned char>(p)))
+                    input.push_back(p);
+            }
+            break;
+
+        case MULTIBYTE:
+            input += terminal.typed();
+            break;
+
         default:
-            if (!iscntrl(c) && c < 128)
+            if (c < 128 && !iscntrl(c))
                 input.push_back(static_cast<char>(c));
             break;
         }
+
+        if (onkey)
+            onkey(input, c);
+    }
+}
+
+void TUI::find() {
+    const int startline = shown->editor.pointer_linepos();
+    const int startchar = shown->editor.pointer_charpos();
+    const struct thing startview = shown->view_offset;
+
+    // each keystroke searches on from the current match rather than from
+    // the top, and a needle that matched nowhere can't match once longer
+    std::pair<int, int> match{startline, startchar};
+    std::string missed;
+
+    auto found = prompt(
+        "Search: ", " (^F next | ESC cancel)",
+        [&](const std::string &needle, echar key) {
+            if (needle.empty()) {
+                match = {startline, startchar};
+                shown->editor.point(startline, startchar);
+                return;
+            }
+            std::pair<int, int> from = match;
+            switch (key) {
+            case CONTROL('f'):
+            case DOWNARROW:
+            case RIGHTARROW:
+                from.second++;
+                break;
+            case CONTROL('h'):
+            case BACKSPACE:
+            case DEL:
+                from = {startline, startchar};
+                break;
+            default:
+                if (!missed.empty() && needle.starts_with(missed))
+                    return;
+                break;
+            }
+
+            auto hit = shown->editor.find(needle, from.first, from.second);
+            if (!hit) {
+                missed = needle;
+                return;
+            }
+            missed.clear();
+            match = *hit;
+            shown->editor.point(hit->first, hit->second);
+        });
+
+    if (!found) {
+        shown->editor.point(startline, startchar);
+        shown->view_offset = startview;
     }
 }
 
 void TUI::save() {
-    if (editor.fileName.empty()) {
+    if (shown->loader.loading()) {
+        set_statusmsg("Still loading, save once the whole file is in");
+        return;
+    }
+    if (shown->saver.saving()) {
+        set_statusmsg("Still saving");
+        return;
+    }
+
+    if (shown->editor.fileName.empty()) {
         auto name = prompt("Save as: ", " (ESC to exit)");
         if (!name) {
             set_statusmsg("Save aborted");
             return;
         }
         const fs::path path = *name;
-        editor.fileName = fs::weakly_canonical(fs::absolute(path)).string();
+        shown->editor.fileName =
+            fs::weakly_canonical(fs::absolute(path)).string();
     }
 
-    std::string dump = editor.dump();
-    std::ofstream out(editor.fileName, std::ios::binary | std::ios::trunc);
-    if (!out) {
-        set_statusmsg(std::string("save failed: ") + std::strerror(errno));
-        return;
+    // the file is replaced by rename, so a mapping of the old one keeps
+    // reading the old bytes and stays valid
+    shown->saver.start(shown->editor, shown->editor.fileName);
+    if (shown->saver.saving())
+        set_statusmsg("Saving...");
+    finish_save();
+}
+
+void TUI::finish_save() {
+    // a save keeps going when its buffer is switched away from
+    for (std::size_t i = 0; i < workspace.size(); i++) {
+        Buffer &buffer = workspace[i];
+        auto done = buffer.saver.collect();
+        if (!done)
+            continue;
+        const std::string which =
+            &buffer == shown ? "" : buffer.name() + ": ";
+        if (!done->error.empty()) {
+            set_statusmsg(which + "save failed: " + done->error);
+            continue;
+        }
+        // edits made while the save was running are still unsaved
+        if (buffer.editor.version() == done->version)
+            buffer.editor.clean();
+        set_statusmsg(which + std::to_string(done->bytes) +
+                      " bytes written to disk");
+    }
+}
+
+std::unique_ptr<RE2> TUI::ask_regex(const std::string &msg) {
+    auto pattern = prompt(msg, " (ESC to cancel)");
+    if (!pattern)
+        return nullptr;
+    RE2::Options options;
+    options.set_log_errors(false);
+    auto re = std::make_unique<RE2>(*pattern, options);
+    if (!re->ok()) {
+        set_statusmsg("bad regex: " + re->error());
+        return nullptr;
     }
+    return re;
+}
 
-    out.write(dump.data(), static_cast<std::streamsize>(dump.size()));
-    if (!out) {
-        set_statusmsg(std::string("save failed: ") + std::strerror(errno));
+void TUI::regex_find() {
+    auto re = ask_regex("Regex: ");
+    if (!re)
+        return;
+
+    // from just past the cursor, so repeating the search moves on
+    auto found = grep.next(shown->editor, *re, shown->editor.pointer_linepos(),
+                           shown->editor.pointer_charpos() + 1);
+    if (!found) {
+        set_statusmsg("No match");
         return;
     }
+    shown->editor.checkpoint();
+    shown->editor.point(found->lineid, found->charid);
+    set_statusmsg("Match at " + std::to_string(found->lineid + 1) + ":" +
+                  std::to_string(found->charid + 1));
+}
 
-    editor.clean();
-    set_statusmsg(std::to_string(dump.size()) + " bytes written to disk");
+void TUI::regex_count() {
+    auto re = ask_regex("Count regex: ");
+    if (!re)
+        return;
+
+    const auto start = std::chrono::steady_clock::now();
+    const std::size_t total = grep.count(shown->editor, *re);
+    const auto took = std::chrono::duration_cast<std::chrono::milliseconds>(
+        std::chrono::steady_clock::now() - start);
+    set_statusmsg(std::to_string(total) + " matches (" +
+                  std::to_string(took.count()) + " ms, " +
+                  std::to_string(pool.size()) + " threads)");
 }
 
 std::unique_ptr<Action> TUI::process_key(echar key) {
@@ -390,10 +793,48 @@ std::unique_ptr<Action> TUI::process_key(echar key) {
         action = std::make_unique<Save>();
         break;
     case CONTROL('l'):
+        action = std::make_unique<Redraw>();
+        break;
+    case CONTROL('f'):
+        action = std::make_unique<Find>();
+        break;
+    case CONTROL('r'):
+        action = std::make_unique<RegexFind>();
+        break;
+    case CONTROL('n'):
+        action = std::make_unique<RegexCount>();
+        break;
+    case CONTROL('o'):
+        action = std::make_unique<OpenBuffer>();
+        break;
+    case CONTROL('b'):
+        action = std::make_unique<SwitchBuffer>();
+        break;
+    case CONTROL('w'):
+        action = std::make_unique<CloseBuffer>();
+        break;
+    case CONTROL('t'):
+        action = std::make_unique<ToggleLatency>();
+        break;
+    case CONTROL('z'):
+        action = std::make_unique<Undo>();
+        break;
+    case CONTROL('y'):
+        action = std::make_unique<Redo>();
+        break;
+
     case '\x1b':
+    case CONTROL('g'): // the AI extension's
         action = std::make_unique<Ignore>();
         break;
 
+    case PASTE:
+        action = std::make_unique<Paste>(terminal.pasted());
+        break;
+    case MULTIBYTE:
+        action = std::make_unique<InsChar>(terminal.typed());
+        break;
+
     case BACKSPACE:
     case CONTROL('h'):
     case DEL:
@@ -428,41 +869,316 @@ std::unique_ptr<Action> TUI::process_key(echar key) {
 }
 
 void TUI::receive_input() {
-    echar key = terminal.read_key();
-
-    if (auto action = process_key(key)) {
-        action->perform(editor, *this);
-        if (key != CONTROL('q'))
-            quit_repeat = QUIT_TIMES;
-    }
+    // keys that came in together are all handled before the next re-index
+    // and redraw
+    do {
+        const auto reading =
+            latency.on ? Latency::clock::now() : Latency::clock::time_point{};
+        echar key = terminal.read_key();
+
+        auto action = process_key(key);
+        if (latency.on) [[unlikely]] {
+            latency.record(Latency::input,
+                           Latency::clock::now() - arrived.value_or(reading));
+            arrived.reset();
+        }
+        if (action) {
+            {
+                Latency::span timing(latency, Latency::perform);
+                action->perform(shown->editor, *this);
+            }
+            if (key != CONTROL('q'))
+                quit_repeat = QUIT_TIMES;
+        }
 
-    // for (auto &entry : extensions) {
-    //     entry->on_key(key, *host);
-    // }
+        for (auto &host : extensions)
+            host->post({.what = ExtensionHost::event::kind::key, .key = key});
+    } while (terminal.buffered());
 
     update_index();
 }
 
 void TUI::draw_screen() {
+    compose();
+    present();
+
+    lastframe = std::chrono::steady_clock::now();
+    stale = false;
+}
+
+void TUI::compose() {
     scroll();
-    terminal << hide_cursor << reset_cursor;
+    update_index();
 
-    terminal.update_winsize();
-    view_size = terminal.window_size();
-    view_size.y -= SBARHEIGHT;
+    // place the view before drawing it, so a jump (search, paste, undo)
+    // shows up in this frame rather than the next one
+    Editor &editor = shown->editor;
+    int rcx = editor.numlines() == 0
+                  ? 0
+                  : render_x(editor.chars_at(editor.pointer_linepos()),
+                             editor.pointer_charpos());
+    cursor_findloc(editor.pointer_linepos(), rcx);
+
+    back.resize(std::max(0, view_size.y + SBARHEIGHT));
+    for (frameline &row : back)
+        row = {};
 
+    finish_save();
+    shown->renders.sync(shown->editor);
+    shown->highlight.sync(shown->editor);
     draw_rows();
     draw_statusbar();
     draw_msgbar();
+    prefetch();
+}
 
-    int rcx = editor.numlines() == 0 ? 0
-                                     : editor.line_at(editor.pointer_linepos())
-                                           .getrx(editor.pointer_charpos());
-    cursor_findloc(editor.pointer_linepos(), rcx);
-    terminal << place_cursor(cursor.x, cursor.y) << show_cursor << send;
+void TUI::load(const std::string &path) {
+    // a file that is already open is just switched to, and one that doesn't
+    // exist yet starts out empty under its name
+    if (auto open = workspace.find(path)) {
+        show(*open);
+        return;
+    }
+    if (!shown->blank())
+        show(workspace.add());
+    if (!fs::exists(path)) {
+        shown->editor.fileName =
+            fs::weakly_canonical(fs::absolute(path)).string();
+        return;
+    }
+    shown->loader.start(shown->editor, path);
+}
+
+void TUI::show(std::size_t which) {
+    workspace.show(which);
+    shown = &workspace.current();
+    published = -1; // to the extensions it is a whole new buffer
+    stale = true;
+}
+
+void TUI::open_buffer() {
+    auto name = prompt("Open: ", " (ESC to cancel)");
+    if (!name)
+        return;
+    try {
+        load(*name);
+    } catch (const std::runtime_error &e) {
+        set_statusmsg(std::string("can't open: ") + e.what());
+    }
+}
+
+// e.g. 512B, 40K, 2.1M
+static std::string human(std::size_t bytes) {
+    static constexpr const char *units = "BKMGT";
+    double size = static_cast<double>(bytes);
+    int unit = 0;
+    while (size >= 1024 && unit < 4) {
+        size /= 1024;
+        unit++;
+    }
+    char text[32];
+    std::snprintf(text, sizeof(text),
+                  size < 10 && unit > 0 ? "%.1f%c" : "%.0f%c", size,
+                  units[unit]);
+    return text;
+}
+
+void TUI::switch_buffer() {
+    // every buffer with its number and what it holds in memory, edited ones
+    // starred
+    std::string listing = " (";
+    std::size_t total = 0;
+    for (std::size_t i = 0; i < workspace.size(); i++) {
+        Buffer &buffer = workspace[i];
+        const std::size_t used = buffer.footprint();
+        total += used;
+        listing += (i > 0 ? " | " : "") + std::to_string(i + 1) + " " +
+                   buffer.name() + (buffer.editor.dirty() ? "*" : "") + " " +
+                   human(used);
+    }
+    listing += ", " + human(total) + " in all, " + human(workspace.spare()) +
+               " spare)";
+
+    auto wanted = prompt("Buffer: ", listing);
+    if (!wanted)
+        return;
+
+    // a number picks by position, anything else the first name with it in
+    std::size_t which = workspace.size();
+    if (std::all_of(wanted->begin(), wanted->end(), [](char c) {
+            return std::isdigit(static_cast<unsigned char>(c)) != 0;
+        })) {
+        // too many digits to parse is just no such buffer
+        std::size_t number = 0;
+        const char *end = wanted->data() + wanted->size();
+        const auto [stop, failed] =
+            std::from_chars(wanted->data(), end, number);
+        if (failed == std::errc{} && stop == end && number > 0)
+            which = number - 1;
+    } else {
+        for (std::size_t i = 0; i < workspace.size(); i++) {
+            if (workspace[i].name().find(*wanted) != std::string::npos) {
+                which = i;
+                break;
+            }
+        }
+    }
+    if (which >= workspace.size()) {
+        set_statusmsg("No buffer " + *wanted);
+        return;
+    }
+    show(which);
+}
+
+void TUI::close_buffer() {
+    if (workspace.size() == 1) {
+        set_statusmsg("The last buffer stays open");
+        return;
+    }
+    if (!shown->loader.idle()) {
+        // the loader lets go once it sees the cancel, which takes a moment
+        cancel_load();
+        set_statusmsg("Load stopped, ^W again to close");
+        return;
+    }
+    if (shown->saver.saving()) {
+        set_statusmsg("Still saving");
+        return;
+    }
+    if (shown->editor.dirty()) {
+        auto sure = prompt("Unsaved changes, close anyway? ", " (y/N)");
+        if (!sure || (*sure != "y" && *sure != "Y"))
+            return;
+    }
+    workspace.close(workspace.position());
+    show(workspace.position());
+}
+
+bool TUI::cancel_load() {
+    if (!shown->loader.loading())
+        return false;
+
+    shown->loader.cancel();
+    // what we have is only the head of the file, saving it over the
+    // original would truncate it
+    shown->editor.fileName.clear();
+    set_statusmsg("Load cancelled after " +
+                  std::to_string(shown->editor.numlines()) + " lines");
+    return true;
+}
+
+EventLoop::happened TUI::await_events() {
+    // a frame held back by the cap is due once the interval is up. while a
+    // load or save runs in the background, wake up regularly to show how it
+    // is going. otherwise sleep until something happens.
+    std::optional<EventLoop::clock::time_point> until;
+    ticking = workspace.busy();
+    if (stale)
+        until = lastframe + FRAME;
+    else if (ticking)
+        until = EventLoop::clock::now() + PROGRESS;
+    EventLoop::happened what{.input = true};
+    if (!terminal.buffered())
+        what = events.wait(until);
+    if (latency.on && what.input) [[unlikely]]
+        arrived = Latency::clock::now();
+    return what;
+}
+
+void TUI::handle(EventLoop::happened what) {
+    const auto now = EventLoop::clock::now();
+    if (what.resized)
+        resize();
+    if (what.input) {
+        receive_input();
+        stale = true;
+    }
+    // whatever the extensions asked for since the last wake, in one go
+    for (auto &host : extensions) {
+        if (host->apply())
+            stale = true;
+    }
+    publish_edits();
+    if (statusmsg_expiry && now >= *statusmsg_expiry) {
+        statusmsg_expiry.reset();
+        if (now - statusmsg_born < MSGLIF) {
+            statusmsg_expiry = statusmsg_born + MSGLIF;
+            events.wake_at(*statusmsg_expiry);
+        } else {
+            stale = true;
+        }
+    }
+    // also catches the tick right after a load or save ended, so the frame
+    // that reports it goes out without waiting for a key
+    if (ticking)
+        stale = true;
+
+    // everything that arrived since the last frame lands in one redraw
+    if (stale && now - lastframe >= FRAME)
+        draw_screen();
+}
+
+void TUI::publish_edits() {
+    if (extensions.empty() || shown->editor.version() == published)
+        return;
+    auto edits = shown->editor.edits_since(published);
+    published = shown->editor.version();
+    for (auto &host : extensions) {
+        if (!edits) {
+            host->post({.what = ExtensionHost::event::kind::replaced});
+            continue;
+        }
+        for (const edit &e : *edits)
+            host->post({.what = ExtensionHost::event::kind::edited,
+                        .lineid = e.lineid,
+                        .removed = e.removed,
+                        .added = e.added});
+    }
+}
+
+echar TUI::await_key() {
+    // with nothing to poll, the terminal has the next key or never will, and
+    // a prompt left waiting for one is cancelled
+    if (terminal.input() == -1)
+        return terminal.key_ready(-1) ? terminal.read_key() : '\x1b';
+
+    // a modal prompt still follows resizes while it waits
+    while (!terminal.buffered()) {
+        auto what = events.wait();
+        if (what.resized) {
+            resize();
+            draw_screen();
+        }
+        if (what.input)
+            break;
+    }
+    return terminal.read_key();
+}
+
+void TUI::toggle_latency() {
+    latency_overlay = !latency_overlay;
+    latency.on = latency_overlay || !latency_file.empty();
+    if (!latency_overlay)
+        set_statusmsg("Timings hidden");
+}
+
+void TUI::dump_latency_to(std::string path) {
+    latency_file = std::move(path);
+    latency.on = latency_overlay || !latency_file.empty();
+}
+
+void TUI::dump_latency() {
+    if (!latency_file.empty() && !latency.dump(latency_file))
+        std::fprintf(stderr, "can't write timings to %s\n",
+                     latency_file.c_str());
 }
 
 void TUI::quit() {
+    dump_latency();
+    for (std::size_t i = 0; i < workspace.size(); i++) {
+        workspace[i].loader.cancel();
+        workspace[i].saver.wait(); // never leave a save half done
+    }
     terminal.disable_raw();
     terminal << clear_screen << reset_cursor << send;
     exit(0);
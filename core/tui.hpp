@@ -4,6 +4,7 @@
 
 #include <chrono>
 #include <fcntl.h>
+#include <functional>
 #include <memory>
 #include <optional>
 #include <stdarg.h>
@@ -20,8 +21,18 @@
 #include <vector>
 
 #include "editor.hpp"
+#include "events.hpp"
 #include "extensions.hpp"
+#include "grep.hpp"
+#include "highlight.hpp"
+#include "latency.hpp"
+#include "loader.hpp"
+#include "pool.hpp"
+#include "render.hpp"
+#include "save.hpp"
 #include "terminal.hpp"
+#include "workspace.hpp"
+#include "wrap.hpp"
 
 constexpr std::string VERSION = "0.0.0.1";
 
@@ -36,13 +47,18 @@ class Action {
 class TUI {
   private:
     Terminal terminal;
-    std::vector<std::unique_ptr<Extension>> extensions;
-    std::optional<ExtensionHost> host;
-    Editor &editor;
+    Workspace &workspace;
+    Buffer *shown; // workspace.current(), which the methods below work on
+    // before anything that starts a thread
+    EventLoop events{terminal.input()};
+    std::vector<std::unique_ptr<ExtensionHost>> extensions;
+    long published = 0; // editor version the extensions have heard about
+    Pool pool;
+    Grep grep{pool};
     std::string statusmsg;
     std::chrono::steady_clock::time_point statusmsg_born;
+    std::optional<std::chrono::steady_clock::time_point> statusmsg_expiry;
 
-    struct thing view_offset;
     struct thing view_size;
     struct thing
         cursor; // location of the cursor relative to the terminal window
@@ -51,8 +67,33 @@ class TUI {
         int lineid;
         int charid;
         int width;
+        int nth; // which row of the line
     };
-    std::vector<struct rowindex> index;
+    struct frameline {
+        std::string text;
+        std::vector<attrspan> spans; // colours, none for plain text
+        bool inverted = false;
+
+        bool operator==(const frameline &) const = default;
+    };
+    std::vector<frameline> front; // what the terminal is showing right now
+    std::vector<frameline> back;  // the frame being composed
+    std::vector<attrspan> linespans; // colours of the line being drawn
+    struct thing painted = {0, 0};
+    struct thing painted_cursor = {-1, -1};
+
+    // input is handled as it comes, but frames go out at most this often
+    static constexpr auto FRAME = std::chrono::milliseconds{16};
+    static constexpr auto PROGRESS = std::chrono::milliseconds{100};
+    std::chrono::steady_clock::time_point lastframe;
+    bool stale = true;    // something changed since the last frame
+    bool ticking = false; // a load or save is showing its progress
+
+    // on while the overlay is up or a dump is wanted at exit
+    Latency latency;
+    bool latency_overlay = false;
+    std::string latency_file;
+    std::optional<Latency::clock::time_point> arrived; // the keys being read
 
     static constexpr int QUIT_TIMES = 2;
 
@@ -66,9 +107,10 @@ class TUI {
 
     void update_index();
     int filled_rows();
-    rowindex &row_at(int absy);
+    rowindex row_at(int absy);
     int get_width(int row);
     int find_width(int row);
+    int step_width(int row);
 
     int absy();
     int absy(int y);
@@ -79,39 +121,68 @@ class TUI {
     void point_editor();
 
     void scroll();
-    void print_welcomemsg();
+    void print_welcomemsg(std::string &row);
     void draw_rows();
     void draw_statusbar();
     void draw_msgbar();
+    void prefetch();
+    void paint(const frameline &row, std::size_t from, std::size_t col);
+    void present();
+    void redraw();
+    void resize();
     void set_statusmsg(std::string);
-    std::optional<std::string> prompt(std::string msgleft,
-                                      std::optional<std::string> msgright);
+    // timings in the message bar instead of messages, and back
+    void toggle_latency();
+    // records timings from now on and writes them to `path` at exit
+    void dump_latency_to(std::string path);
+    void dump_latency();
+    // `onkey` sees the input after every keystroke, e.g. to search as you
+    // type
+    std::optional<std::string>
+    prompt(std::string msgleft, std::optional<std::string> msgright,
+           const std::function<void(const std::string &, echar)> &onkey = {});
     void draw_screen();
+    // builds the next frame in memory without sending it, which is all of
+    // draw_screen() but the terminal writes
+    void compose();
 
     void save();
+    void find();
+    std::unique_ptr<RE2> ask_regex(const std::string &msg);
+    void regex_find();
+    void regex_count();
+    void finish_save();
+
+    void load(const std::string &path);
+    bool cancel_load();
 
     void quit();
 
     std::unique_ptr<Action> process_key(echar key);
+    void publish_edits();
+    EventLoop::happened await_events();
+    void handle(EventLoop::happened what);
+    echar await_key();
     void receive_input();
 
-    TUI(Editor &editor, Terminal terminal)
-        : terminal(terminal), editor(editor), statusmsg(""),
-          statusmsg_born(std::chrono::steady_clock::now()), view_offset{0, 0},
-          view_size{0, 0}, cursor{0, 0} {
+    // buffers
+    void show(std::size_t which);
+    void open_buffer();
+    void switch_buffer();
+    void close_buffer();
+    bool unsaved() { return workspace.dirty(); }
+
+    TUI(Workspace &workspace, Terminal terminal)
+        : terminal(terminal), workspace(workspace),
+          shown(&workspace.current()), statusmsg(""),
+          statusmsg_born(std::chrono::steady_clock::now()), view_size{0, 0},
+          cursor{0, 0} {
         view_size = terminal.window_size();
         view_size.y -= SBARHEIGHT;
-        index.reserve(view_size.y);
 
         terminal.enable_raw();
         terminal << clear_screen << reset_cursor << send;
-        set_statusmsg("^Q to quit | ^S to save");
-
-        host.emplace(editor, *this);
-
-        for (auto &entry : extensions) {
-            entry->on_start(*host);
-        }
+        set_statusmsg("^Q to quit | ^S to save | ^F find | ^Z undo | ^Y redo");
     }
 
     ~TUI() { terminal.disable_raw(); }
@@ -124,8 +195,11 @@ class Quit final : public Action {
   public:
     explicit Quit(int &quit_repeat) : rep(quit_repeat) {}
     void perform(Editor &e, TUI &ui) override {
-        if (e.dirty() && rep > 0) {
-            ui.set_statusmsg("File has unsaved changes. Press ^Q " +
+        if (ui.cancel_load())
+            return;
+        if (ui.unsaved() && rep > 0) {
+            const std::string which = e.dirty() ? "File" : "Another buffer";
+            ui.set_statusmsg(which + " has unsaved changes. Press ^Q " +
                              std::to_string(rep) + " more times to quit.");
             rep--;
             return;
@@ -134,6 +208,26 @@ class Quit final : public Action {
     }
 };
 
+class ToggleLatency final : public Action {
+  public:
+    void perform(Editor &, TUI &ui) override { ui.toggle_latency(); }
+};
+
+class OpenBuffer final : public Action {
+  public:
+    void perform(Editor &, TUI &ui) override { ui.open_buffer(); }
+};
+
+class SwitchBuffer final : public Action {
+  public:
+    void perform(Editor &, TUI &ui) override { ui.switch_buffer(); }
+};
+
+class CloseBuffer final : public Action {
+  public:
+    void perform(Editor &, TUI &ui) override { ui.close_buffer(); }
+};
+
 class Save final : public Action {
   public:
     void perform(Editor &, TUI &ui) override { ui.save(); };
@@ -141,16 +235,20 @@ class Save final : public Action {
 
 class InsChar final : public Action {
   public:
-    echar c;
-    explicit InsChar(echar c) : c(c) {};
-    void perform(Editor &e, TUI &) override { e.inschar(c); }
+    std::string bytes; // one character, utf-8 encoded
+    explicit InsChar(echar c) : bytes(1, static_cast<char>(c)) {};
+    explicit InsChar(std::string bytes) : bytes(std::move(bytes)) {};
+    void perform(Editor &e, TUI &) override { e.inschar(bytes); }
 };
 
 class MoveCursor final : public Action {
   public:
     echar key;
     explicit MoveCursor(echar k) : key(k) {};
-    void perform(Editor &, TUI &ui) override { ui.move_cursor(key); }
+    void perform(Editor &e, TUI &ui) override {
+        e.checkpoint();
+        ui.move_cursor(key);
+    }
 };
 
 class Return final : public Action {
@@ -158,6 +256,22 @@ class Return final : public Action {
     void perform(Editor &e, TUI &) override { e.insnewln_atptr(); }
 };
 
+// a whole paste goes in as one edit, one undo step and one redraw
+class Paste final : public Action {
+  private:
+    std::string text;
+
+  public:
+    explicit Paste(std::string text) : text(std::move(text)) {}
+    void perform(Editor &e, TUI &) override {
+        e.checkpoint();
+        auto [lineid, charid] =
+            e.insert_text(e.pointer_linepos(), e.pointer_charpos(), text);
+        e.point(lineid, charid);
+        e.checkpoint();
+    }
+};
+
 class Delete final : public Action {
   public:
     echar key;
@@ -170,6 +284,42 @@ class Delete final : public Action {
     }
 };
 
+class Find final : public Action {
+  public:
+    void perform(Editor &, TUI &ui) override { ui.find(); }
+};
+
+class RegexFind final : public Action {
+  public:
+    void perform(Editor &, TUI &ui) override { ui.regex_find(); }
+};
+
+class RegexCount final : public Action {
+  public:
+    void perform(Editor &, TUI &ui) override { ui.regex_count(); }
+};
+
+class Undo final : public Action {
+  public:
+    void perform(Editor &e, TUI &ui) override {
+        if (!e.undo())
+            ui.set_statusmsg("Nothing to undo");
+    }
+};
+
+class Redo final : public Action {
+  public:
+    void perform(Editor &e, TUI &ui) override {
+        if (!e.redo())
+            ui.set_statusmsg("Nothing to redo");
+    }
+};
+
+class Redraw final : public Action {
+  public:
+    void perform(Editor &, TUI &ui) override { ui.redraw(); };
+};
+
 class Ignore final : public Action {
   public:
     void perform(Editor &, TUI &) override {};
@@ -0,0 +1,161 @@
+// workspace
+
+#pragma once
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <string>
+#include <vector>
+
+#include "editor.hpp"
+#include "highlight.hpp"
+#include "loader.hpp"
+#include "render.hpp"
+#include "save.hpp"
+#include "wrap.hpp"
+
+// one open file: the text, its background load and save, and how the ui last
+// showed it. switching back to a buffer finds it indexed and scrolled the way
+// it was left.
+struct Buffer {
+    const std::uint64_t id; // never reused, so a stale one finds nothing
+    Editor editor;
+    Loader loader;
+    Saver saver;
+    WrapIndex index;
+    int indexed_width = 0;
+    long indexed_version = -1;
+    RenderCache renders;
+    Highlighter highlight;
+    thing view_offset{0, 0};
+
+    // the trees of every buffer draw on the workspace's `slabs`
+    Buffer(std::shared_ptr<std::mutex> guard, std::uint64_t id,
+           const std::shared_ptr<Slabs> &slabs)
+        : id(id), editor(std::move(guard), slabs), index(slabs),
+          highlight(slabs) {}
+
+    Buffer(const Buffer &) = delete;
+    Buffer &operator=(const Buffer &) = delete;
+
+    std::string name() const {
+        if (editor.fileName.empty())
+            return "[No Name]";
+        return fs::path(editor.fileName).filename().string();
+    }
+
+    // nothing in it and nothing to lose, so a file can be opened over it
+    bool blank() {
+        return editor.fileName.empty() && editor.numlines() == 0 &&
+               !editor.dirty() && loader.idle() && !saver.saving();
+    }
+
+    // what it holds in memory, the editor's and the ui's caches together
+    std::size_t footprint() {
+        return editor.memory().resident() + renders.footprint();
+    }
+};
+
+// every open buffer and which one is shown. they all share one lock, which
+// is what the ui holds between waits, so a background load into any of them
+// never races a switch. switching only moves a pointer. they also share the
+// slabs their line trees, wrap indexes and colour states are built from, so
+// a closed buffer's nodes go to the next one opened.
+class Workspace {
+  private:
+    std::shared_ptr<std::mutex> guard = std::make_shared<std::mutex>();
+    std::shared_ptr<Slabs> slabs = std::make_shared<Slabs>();
+    std::vector<std::unique_ptr<Buffer>> buffers;
+    std::size_t shown = 0;
+    std::size_t previous = 0;
+    std::uint64_t issued = 0;
+
+  public:
+    Workspace() { add(); }
+
+    Workspace(const Workspace &) = delete;
+    Workspace &operator=(const Workspace &) = delete;
+
+    std::unique_lock<std::mutex> lock() {
+        return std::unique_lock<std::mutex>(*guard);
+    }
+
+    Buffer &current() { return *buffers[shown]; }
+    std::size_t position() const { return shown; }
+    std::size_t size() const { return buffers.size(); }
+    Buffer &operator[](std::size_t which) { return *buffers[which]; }
+
+    // bytes the shared slabs hold that no buffer is using right now
+    std::size_t spare() { return slabs->reserved() - slabs->used(); }
+
+    // a new empty buffer at the end, not shown yet
+    std::size_t add() {
+        buffers.push_back(std::make_unique<Buffer>(guard, ++issued, slabs));
+        return buffers.size() - 1;
+    }
+
+    // the open buffer with Buffer::id `id`, null once it is closed
+    Buffer *by_id(std::uint64_t id) {
+        for (auto &buffer : buffers) {
+            if (buffer->id == id)
+                return buffer.get();
+        }
+        return nullptr;
+    }
+
+    // the buffer holding `path`, if one does
+    std::optional<std::size_t> find(const std::string &path) const {
+        std::error_code failed;
+        const fs::path wanted = fs::weakly_canonical(path, failed);
+        for (std::size_t i = 0; i < buffers.size(); i++) {
+            const std::string &name = buffers[i]->editor.fileName;
+            if (!name.empty() && fs::path(name) == wanted)
+                return i;
+        }
+        return std::nullopt;
+    }
+
+    // the one switched away from keeps its index and place but lets go of
+    // its rendered lines, which are quick to make again for one screen
+    void show(std::size_t which) {
+        if (which == shown || which >= buffers.size())
+            return;
+        buffers[shown]->renders.clear();
+        previous = shown;
+        shown = which;
+    }
+
+    // the buffer shown before this one, for flipping between two
+    void show_previous() { show(previous); }
+
+    // drops buffer `which`, showing a neighbour if it was the shown one.
+    // the last buffer is never closed. its loader has to be idle().
+    void close(std::size_t which) {
+        if (buffers.size() <= 1 || which >= buffers.size())
+            return;
+        buffers.erase(buffers.begin() + static_cast<std::ptrdiff_t>(which));
+        auto moved = [&](std::size_t at) {
+            if (at > which)
+                return at - 1;
+            return std::min(at, buffers.size() - 1);
+        };
+        shown = moved(shown);
+        previous = moved(previous);
+    }
+
+    bool dirty() const {
+        return std::any_of(buffers.begin(), buffers.end(),
+                           [](const auto &b) { return b->editor.dirty(); });
+    }
+
+    // whether any buffer is loading or saving in the background
+    bool busy() const {
+        return std::any_of(buffers.begin(), buffers.end(), [](const auto &b) {
+            return b->loader.loading() || b->saver.saving();
+        });
+    }
+};
@@ -0,0 +1,129 @@
+// wrap index
+
+#pragma once
+
+#include <utility>
+#include <vector>
+
+#include "rope.hpp"
+
+// maps screen rows to lines. consecutive lines that wrap into the same number
+// of rows share one run, so a file of short lines costs a handful of nodes,
+// and row <-> line lookups are O(log n) walks down the rope.
+
+struct wrapsum {
+    int lines;
+    int rows;
+
+    wrapsum operator+(const wrapsum &other) const {
+        return {lines + other.lines, rows + other.rows};
+    }
+};
+
+struct wraprun {
+    int lines; // how many consecutive lines this run covers
+    int rows;  // rows taken by each of them
+};
+
+struct wrap_measure {
+    wrapsum operator()(const wraprun &run) const {
+        return {run.lines, run.lines * run.rows};
+    }
+};
+
+class WrapIndex {
+  private:
+    Rope<wraprun, wrap_measure> runs;
+
+    // makes sure a run starts exactly at `lineid` and returns its position
+    std::size_t cut(int lineid) {
+        auto [at, before] =
+            runs.search([&](const wrapsum &sum) { return sum.lines > lineid; });
+        if (at >= runs.size() || before.lines == lineid)
+            return at;
+
+        wraprun &run = runs.at(at);
+        const int head = lineid - before.lines;
+        const wraprun tail{run.lines - head, run.rows};
+        run.lines = head;
+        runs.remeasure(at);
+        runs.insert(at + 1, tail);
+        return at + 1;
+    }
+
+  public:
+    explicit WrapIndex(std::shared_ptr<Slabs> slabs = Slabs::fallback())
+        : runs(std::move(slabs)) {}
+
+    // rows a line of `length` render columns takes at `width` columns. a line
+    // that exactly fills its last row gets an extra empty row for the cursor.
+    static int rows_for(int length, int width) { return length / width + 1; }
+
+    int lines() { return runs.total().lines; }
+    int rows() { return runs.total().rows; }
+    bool empty() { return runs.empty(); }
+
+    void clear() { runs.clear(); }
+
+    static std::vector<wraprun> pack(const std::vector<int> &rowcounts) {
+        std::vector<wraprun> packed;
+        for (int rows : rowcounts) {
+            if (!packed.empty() && packed.back().rows == rows)
+                packed.back().lines++;
+            else
+                packed.push_back({1, rows});
+        }
+        return packed;
+    }
+
+    void assign(const std::vector<int> &rowcounts) {
+        runs.assign(pack(rowcounts));
+    }
+
+    void insert(int lineid, int count, int rows) {
+        if (count <= 0)
+            return;
+        runs.insert(cut(lineid), {count, rows});
+    }
+
+    void erase(int lineid, int count) {
+        if (count <= 0)
+            return;
+        const std::size_t first = cut(lineid);
+        const std::size_t last = cut(lineid + count);
+        runs.erase(first, last);
+    }
+
+    // re-wraps the lines from `lineid` on with fresh row counts
+    void replace(int lineid, const std::vector<int> &rowcounts) {
+        erase(lineid, static_cast<int>(rowcounts.size()));
+        runs.splice(cut(lineid), Rope<wraprun, wrap_measure>(
+                                     pack(rowcounts), runs.allocator()));
+    }
+
+    // first row of `lineid`
+    int first_row(int lineid) {
+        auto [at, before] =
+            runs.search([&](const wrapsum &sum) { return sum.lines > lineid; });
+        if (at >= runs.size())
+            return before.rows;
+        return before.rows + (lineid - before.lines) * runs.at(at).rows;
+    }
+
+    int rows_of(int lineid) {
+        auto [at, before] =
+            runs.search([&](const wrapsum &sum) { return sum.lines > lineid; });
+        return at < runs.size() ? runs.at(at).rows : 0;
+    }
+
+    // line holding `row`, and which of that line's rows it is
+    std::pair<int, int> locate(int row) {
+        auto [at, before] =
+            runs.search([&](const wrapsum &sum) { return sum.rows > row; });
+        if (at >= runs.size())
+            return {before.lines, 0};
+        const int per = runs.at(at).rows;
+        const int into = row - before.rows;
+        return {before.lines + into / per, into % per};
+    }
+};
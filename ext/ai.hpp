@@ -0,0 +1,368 @@
+// ai completion extension
+
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <functional>
+#include <optional>
+#include <stop_token>
+#include <string>
+#include <string_view>
+#include <thread>
+
+#include <curl/curl.h>
+#include <nlohmann/json.hpp>
+
+#include "extensions.hpp"
+#include "snapshot.hpp"
+#include "terminal.hpp"
+
+namespace ai {
+
+using clock = std::chrono::steady_clock;
+
+struct config {
+    std::string url;
+    std::string model;
+    std::string key;
+    std::size_t context = 16 << 10; // bytes from the end of the buffer
+    int maxtokens = 512;
+
+    // AI_URL (an OpenAI style chat completions endpoint), AI_MODEL, AI_KEY
+    static config from_env() {
+        auto get = [](const char *name, const char *fallback) {
+            const char *value = std::getenv(name);
+            return std::string(value ? value : fallback);
+        };
+        return {get("AI_URL", ""), get("AI_MODEL", "gpt-4o-mini"),
+                get("AI_KEY", "")};
+    }
+};
+
+// how one completion went
+struct stats {
+    clock::duration first{};   // request sent to first token received
+    clock::duration total{};   // request sent to stream closed
+    std::size_t tokens = 0;    // one per streamed event with text in it
+    std::size_t bytes = 0;
+    long status = 0;           // http status
+    std::string error;
+
+    double rate() const {
+        const double seconds =
+            std::chrono::duration<double>(total - first).count();
+        return seconds > 0 ? static_cast<double>(tokens) / seconds : 0;
+    }
+
+    std::string summary() const {
+        char line[128];
+        std::snprintf(
+            line, sizeof(line), "%zu tokens, first after %lld ms, %.0f tok/s",
+            tokens,
+            static_cast<long long>(
+                std::chrono::duration_cast<std::chrono::milliseconds>(first)
+                    .count()),
+            rate());
+        return line;
+    }
+};
+
+// the text in one server-sent event's data, for both the chat and the plain
+// completions flavour. nullopt for "[DONE]" and for anything unreadable.
+inline std::optional<std::string> parse_event(std::string_view data) {
+    if (data == "[DONE]")
+        return std::nullopt;
+    const auto event = nlohmann::json::parse(data, nullptr, false);
+    if (event.is_discarded() || !event.contains("choices") ||
+        !event["choices"].is_array() || event["choices"].empty())
+        return std::nullopt;
+    const auto &choice = event["choices"][0];
+    if (choice.contains("delta") && choice["delta"].contains("content") &&
+        choice["delta"]["content"].is_string())
+        return choice["delta"]["content"].get<std::string>();
+    if (choice.contains("text") && choice["text"].is_string())
+        return choice["text"].get<std::string>();
+    return std::nullopt;
+}
+
+// how often complete() calls its `ontick` while a stream is open
+inline constexpr auto TICK = std::chrono::milliseconds{4};
+
+// streams one completion of `prompt`, calling `ontext` with each piece of
+// text as it arrives, and `ontick` at least every TICK in between, pauses
+// in the stream included. blocks until the stream ends or `stop` is
+// requested.
+inline stats complete(const config &settings, const std::string &prompt,
+                      const std::function<void(std::string_view)> &ontext,
+                      std::stop_token stop = {},
+                      const std::function<void()> &ontick = {}) {
+    struct state {
+        const std::function<void(std::string_view)> &ontext;
+        std::stop_token stop;
+        clock::time_point start;
+        std::string partial; // a line that hasn't ended yet
+        bool done = false;
+        stats result;
+
+        void line(std::string_view text) {
+            if (done)
+                return;
+            if (!text.empty() && text.back() == '\r')
+                text.remove_suffix(1);
+            if (!text.starts_with("data:"))
+                return; // blank separators, comments, other fields
+            text.remove_prefix(5);
+            if (!text.empty() && text.front() == ' ')
+                text.remove_prefix(1);
+            if (text == "[DONE]") {
+                done = true;
+                return;
+            }
+            auto piece = parse_event(text);
+            if (!piece || piece->empty())
+                return;
+            if (result.tokens++ == 0)
+                result.first = clock::now() - start;
+            result.bytes += piece->size();
+            ontext(*piece);
+        }
+
+        static std::size_t receive(char *bytes, std::size_t size,
+                                   std::size_t count, void *self) {
+            auto &s = *static_cast<state *>(self);
+            std::string_view in(bytes, size * count);
+            // lines are handed over as they end, without waiting for more
+            while (!in.empty()) {
+                const std::size_t nl = in.find('\n');
+                if (nl == std::string_view::npos) {
+                    s.partial.append(in);
+                    break;
+                }
+                if (s.partial.empty()) {
+                    s.line(in.substr(0, nl));
+                } else {
+                    s.partial.append(in.substr(0, nl));
+                    s.line(s.partial);
+                    s.partial.clear();
+                }
+                in.remove_prefix(nl + 1);
+            }
+            return size * count;
+        }
+
+        static int progress(void *self, curl_off_t, curl_off_t, curl_off_t,
+                            curl_off_t) {
+            return static_cast<state *>(self)->stop.stop_requested() ? 1 : 0;
+        }
+    } s{ontext, stop, clock::now(), {}, false, {}};
+
+    if (settings.url.empty()) {
+        s.result.error = "AI_URL is not set";
+        return s.result;
+    }
+
+    const std::string body =
+        nlohmann::json{
+            {"model", settings.model},
+            {"stream", true},
+            {"max_tokens", settings.maxtokens},
+            {"messages",
+             {{{"role", "system"},
+               {"content", "Continue the user's text. Reply with the "
+                           "continuation only."}},
+              {{"role", "user"}, {"content", prompt}}}},
+        }
+            .dump();
+
+    CURL *curl = curl_easy_init();
+    if (!curl) {
+        s.result.error = "curl_easy_init failed";
+        return s.result;
+    }
+    curl_slist *headers = nullptr;
+    headers = curl_slist_append(headers, "Content-Type: application/json");
+    headers = curl_slist_append(headers, "Accept: text/event-stream");
+    if (!settings.key.empty())
+        headers = curl_slist_append(
+            headers, ("Authorization: Bearer " + settings.key).c_str());
+
+    curl_easy_setopt(curl, CURLOPT_URL, settings.url.c_str());
+    curl_easy_setopt(curl, CURLOPT_HTTPHEADER, headers);
+    curl_easy_setopt(curl, CURLOPT_POSTFIELDS, body.c_str());
+    curl_easy_setopt(curl, CURLOPT_POSTFIELDSIZE,
+                     static_cast<long>(body.size()));
+    curl_easy_setopt(curl, CURLOPT_WRITEFUNCTION, &state::receive);
+    curl_easy_setopt(curl, CURLOPT_WRITEDATA, &s);
+    curl_easy_setopt(curl, CURLOPT_NOPROGRESS, 0L);
+    curl_easy_setopt(curl, CURLOPT_XFERINFOFUNCTION, &state::progress);
+    curl_easy_setopt(curl, CURLOPT_XFERINFODATA, &s);
+    curl_easy_setopt(curl, CURLOPT_NOSIGNAL, 1L);
+    curl_easy_setopt(curl, CURLOPT_TCP_NODELAY, 1L);
+
+    // the multi interface rather than curl_easy_perform, so waiting on the
+    // socket wakes up every tick to let `ontick` run
+    CURLM *multi = curl_multi_init();
+    curl_multi_add_handle(multi, curl);
+    s.start = clock::now();
+    CURLcode code = CURLE_OK;
+    for (int running = 1; running;) {
+        if (curl_multi_perform(multi, &running) != CURLM_OK) {
+            code = CURLE_FAILED_INIT;
+            break;
+        }
+        if (running)
+            curl_multi_poll(multi, nullptr, 0,
+                            static_cast<int>(TICK.count()), nullptr);
+        if (ontick)
+            ontick();
+    }
+    int left = 0;
+    while (CURLMsg *message = curl_multi_info_read(multi, &left)) {
+        if (message->msg == CURLMSG_DONE)
+            code = message->data.result;
+    }
+    s.result.total = clock::now() - s.start;
+    if (!s.partial.empty())
+        s.line(s.partial);
+    curl_easy_getinfo(curl, CURLINFO_RESPONSE_CODE, &s.result.status);
+    if (code == CURLE_ABORTED_BY_CALLBACK)
+        s.result.error = "cancelled";
+    else if (code != CURLE_OK)
+        s.result.error = curl_easy_strerror(code);
+    else if (s.result.status >= 400)
+        s.result.error = "HTTP " + std::to_string(s.result.status);
+
+    curl_multi_remove_handle(multi, curl);
+    curl_multi_cleanup(multi);
+    curl_slist_free_all(headers);
+    curl_easy_cleanup(curl);
+    return s.result;
+}
+
+// gathers streamed text and passes it on at most about once a frame, so a
+// fast stream costs one edit and one redraw per frame rather than per token.
+// text is never held much past a frame: tick() lets it out on a deadline
+// when nothing more arrives to do it.
+class Batcher {
+  private:
+    std::function<void(std::string)> flush;
+    std::string pending;
+    clock::time_point last{};
+
+  public:
+    static constexpr auto EVERY = std::chrono::milliseconds{16};
+
+    explicit Batcher(std::function<void(std::string)> flush)
+        : flush(std::move(flush)) {}
+
+    void add(std::string_view text) {
+        pending.append(text);
+        tick();
+    }
+
+    // passes on what is pending once a frame has gone by since the last
+    // time, for calling every so often while the stream is quiet
+    void tick() {
+        const auto now = clock::now();
+        if (now - last >= EVERY)
+            finish(now);
+    }
+
+    void finish(clock::time_point now = clock::now()) {
+        if (pending.empty())
+            return;
+        flush(std::exchange(pending, {}));
+        last = now;
+    }
+};
+
+// the last `limit` bytes of whole lines, what the model gets to continue
+inline std::string tail(const Snapshot &snap, std::size_t limit) {
+    int first = snap.lines();
+    std::size_t bytes = 0;
+    while (first > 0 && bytes < limit)
+        bytes += snap.line(--first).size() + 1;
+    std::string out;
+    out.reserve(bytes);
+    snap.visit_lines(first, [&](std::string_view chars) {
+        out.append(chars);
+        out.push_back('\n');
+        return true;
+    });
+    if (!out.empty())
+        out.pop_back();
+    return out;
+}
+
+} // namespace ai
+
+// ^G streams a completion of the buffer onto its end, ^G again stops it.
+// the request runs on a thread of its own, so the extension keeps hearing
+// keys meanwhile. while it runs, it is the only one sending the host
+// commands. the text keeps going to the buffer ^G was pressed in when
+// another is shown, and stops if that one is closed.
+class AI final : public Extension {
+  private:
+    ai::config settings;
+    std::atomic<bool> streaming{false};
+    std::uint64_t target = 0; // the buffer being completed
+    std::jthread request;
+
+  public:
+    static constexpr int KEY = CONTROL('g');
+
+    explicit AI(ai::config settings = ai::config::from_env())
+        : settings(std::move(settings)) {
+        static const bool ready = curl_global_init(CURL_GLOBAL_DEFAULT) == 0;
+        (void)ready;
+    }
+
+    void on_key(int key, ExtensionHost &host) override {
+        if (key != KEY)
+            return;
+        if (streaming) {
+            request.request_stop(); // it reports back itself
+            return;
+        }
+        if (request.joinable())
+            request.join(); // the last one is done, just not reaped
+
+        auto snap = host.snapshot();
+        if (!snap)
+            return;
+        target = host.shown();
+        std::string prompt = ai::tail(*snap, settings.context);
+        streaming = true;
+        request = std::jthread([this, &host, into = target,
+                                prompt = std::move(prompt)](
+                                   std::stop_token stop) {
+            host.set_statusmsg("ai: waiting for " + settings.model + "...");
+            ai::Batcher out(
+                [&](std::string text) { host.insert_text(text, into); });
+            const ai::stats result = ai::complete(
+                settings, prompt, [&](std::string_view text) { out.add(text); },
+                stop, [&] { out.tick(); });
+            out.finish();
+            host.set_statusmsg(result.error.empty()
+                                   ? "ai: " + result.summary()
+                                   : "ai: " + result.error + " after " +
+                                         result.summary());
+            streaming = false;
+        });
+    }
+
+    void on_replace(ExtensionHost &host) override {
+        if (streaming && !host.snapshot(target))
+            request.request_stop();
+    }
+
+    // the stream reports back through the host, so it ends before the host
+    void on_stop(ExtensionHost &) override {
+        request.request_stop();
+        if (request.joinable())
+            request.join();
+    }
+};
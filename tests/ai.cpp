@@ -0,0 +1,149 @@
+// the ai extension through its host against the local mock endpoint: the
+// tail of a stream that stalls, a switch of buffer mid-stream, the cursor
+// while text streams in, and the host going away mid-stream
+
+#include <chrono>
+#include <functional>
+#include <memory>
+#include <string>
+#include <thread>
+
+#include "ai.hpp"
+#include "check.hpp"
+#include "mock.hpp"
+#include "tui.hpp"
+
+namespace {
+
+using namespace std::chrono_literals;
+
+// a workspace and headless ui for the host to work on
+struct fixture {
+    std::shared_ptr<HeadlessBackend> headless =
+        std::make_shared<HeadlessBackend>(thing{80, 24});
+    Workspace workspace;
+    TUI ui{workspace, Terminal(headless)};
+    EventLoop loop{-1};
+    std::unique_ptr<ExtensionHost> host;
+
+    explicit fixture(const MockServer &server) {
+        ai::config settings;
+        settings.url = server.url();
+        host = std::make_unique<ExtensionHost>(
+            workspace, ui, loop, std::make_unique<AI>(settings));
+    }
+
+    void post(ExtensionHost::event e) {
+        auto hold = workspace.lock();
+        host->post(e);
+    }
+
+    // applies what the host sends, the way the ui loop does, until `done`
+    // holds or `limit` passes
+    bool until(const std::function<bool()> &done,
+               std::chrono::milliseconds limit) {
+        const auto give_up = std::chrono::steady_clock::now() + limit;
+        while (std::chrono::steady_clock::now() < give_up) {
+            {
+                auto hold = workspace.lock();
+                host->apply();
+                if (done())
+                    return true;
+            }
+            std::this_thread::sleep_for(2ms);
+        }
+        return false;
+    }
+};
+
+std::string repeat(const std::string &text, int times) {
+    std::string out;
+    for (int i = 0; i < times; i++)
+        out += text;
+    return out;
+}
+
+// the last tokens show up while the model is still pausing, not only once
+// the stream ends
+void stalled() {
+    MockServer server({20, "lorem ", 0us, 1000us, 3000ms});
+    fixture f(server);
+    f.post({.what = ExtensionHost::event::kind::key, .key = AI::KEY});
+    const std::string whole = repeat("lorem ", 20);
+    Editor &editor = f.workspace.current().editor;
+    check(f.until([&] { return editor.dump() == whole + "\n"; }, 1000ms),
+          "the tail of a stalled stream reaches the buffer");
+}
+
+// text keeps going to the buffer ^G was pressed in after another is shown
+void switched() {
+    MockServer server({40, "ipsum ", 50ms, 2ms, 0us});
+    fixture f(server);
+    Editor &first = f.workspace.current().editor;
+    f.post({.what = ExtensionHost::event::kind::key, .key = AI::KEY});
+    {
+        auto hold = f.workspace.lock();
+        f.workspace.show(f.workspace.add());
+    }
+    f.post({.what = ExtensionHost::event::kind::replaced});
+    Editor &second = f.workspace.current().editor;
+    const std::string whole = repeat("ipsum ", 40);
+    check(f.until([&] { return first.dump() == whole + "\n"; }, 2000ms),
+          "the stream lands in the buffer it started in");
+    check(second.numlines() == 0, "the buffer shown later is left alone");
+}
+
+// text streams in at the end without pulling the cursor away from where the
+// user is, but carries along one left waiting at the end
+void cursor() {
+    for (const bool waiting : {false, true}) {
+        MockServer server({10, "amet ", 0us, 1ms, 0us});
+        fixture f(server);
+        Editor &editor = f.workspace.current().editor;
+        {
+            auto hold = f.workspace.lock();
+            editor.insln(0, "first");
+            editor.insln(1, "second");
+            if (waiting)
+                editor.point(1, 6);
+            else
+                editor.point(0, 2);
+        }
+        f.post({.what = ExtensionHost::event::kind::key, .key = AI::KEY});
+        const std::string whole = "first\nsecond" + repeat("amet ", 10);
+        check(f.until([&] { return editor.dump() == whole + "\n"; }, 2000ms),
+              "the stream lands at the end");
+        if (waiting)
+            check(editor.pointer_linepos() == 1 &&
+                      editor.pointer_charpos() ==
+                          static_cast<int>(editor.chars_at(1).size()),
+                  "a cursor at the end follows the text");
+        else
+            check(editor.pointer_linepos() == 0 &&
+                      editor.pointer_charpos() == 2,
+                  "the cursor stays where the user left it");
+    }
+}
+
+// the host goes away while a stream is still sending it text
+void stopped() {
+    MockServer server({5, "dolor ", 0us, 0us, 5000ms});
+    fixture f(server);
+    f.post({.what = ExtensionHost::event::kind::key, .key = AI::KEY});
+    Editor &editor = f.workspace.current().editor;
+    f.until([&] { return editor.numlines() > 0; }, 1000ms);
+    const auto start = std::chrono::steady_clock::now();
+    f.host.reset();
+    check(std::chrono::steady_clock::now() - start < 1000ms,
+          "the host stops a stream without waiting it out");
+}
+
+} // namespace
+
+int main() {
+    stalled();
+    switched();
+    cursor();
+    stopped();
+    return finish();
+}
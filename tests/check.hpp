@@ -0,0 +1,23 @@
+// what the tests share: checks that report a failure and carry on, and an
+// exit status that says whether any failed
+
+#pragma once
+
+#include <cstdio>
+#include <cstdlib>
+
+inline int failures = 0;
+
+inline void check(bool ok, const char *what) {
+    if (!ok) {
+        std::fprintf(stderr, "FAIL: %s\n", what);
+        failures++;
+    }
+}
+
+// for main() to return once every check has run
+inline int finish() {
+    if (failures == 0)
+        std::puts("ok");
+    return failures == 0 ? EXIT_SUCCESS : EXIT_FAILURE;
+}
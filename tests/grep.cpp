@@ -0,0 +1,42 @@
+// regex search over lines far longer than a backtracking engine can take
+
+#include <string>
+
+#include "check.hpp"
+#include "grep.hpp"
+
+int main() {
+    Pool pool(4);
+    Grep grep(pool);
+
+    // one line of a few megabytes, the shape of minified json
+    const std::string line = "x" + std::string(4 << 20, '-') + "y";
+    Editor editor;
+    editor.insln(0, line);
+    editor.insln(1, "xy and x-y");
+
+    const RE2 span("x.*y");
+    check(grep.count(editor, span) == 2, "count spans a long line");
+
+    const auto all = grep.find_all(editor, RE2("x-*y"));
+    check(all.size() == 3, "find_all finds every match");
+    check(!all.empty() && all[0].lineid == 0 && all[0].charid == 0 &&
+              all[0].length == static_cast<int>(line.size()),
+          "find_all match covers the long line");
+
+    const auto next = grep.next(editor, RE2("y"), 0, 1);
+    check(next && next->lineid == 0 &&
+              next->charid == static_cast<int>(line.size()) - 1,
+          "next finds the end of the long line");
+
+    // `^` only matches at the real start of a line, not where a search
+    // resumes
+    check(!grep.next(editor, RE2("^-"), 0, 1), "^ anchors to the line start");
+
+    // empty matches step on a character at a time
+    Editor wide;
+    wide.insln(0, "a中b");
+    check(grep.count(wide, RE2("")) == 4, "empty matches per character");
+
+    return finish();
+}
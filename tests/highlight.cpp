@@ -0,0 +1,58 @@
+// colours land on the columns their text is drawn at, bytes that aren't
+// utf-8 included
+
+#include <string_view>
+#include <vector>
+
+#include "check.hpp"
+#include "highlight.hpp"
+
+namespace {
+
+// render column the first span painted `paint` starts at, -1 if none is
+int column_of(const std::vector<attrspan> &spans, colour paint) {
+    int col = 0;
+    for (const attrspan &span : spans) {
+        if (span.paint == paint)
+            return col;
+        col += span.length;
+    }
+    return -1;
+}
+
+int total(const std::vector<attrspan> &spans) {
+    int col = 0;
+    for (const attrspan &span : spans)
+        col += span.length;
+    return col;
+}
+
+// colours `line` and checks the first `paint` span starts where `before`,
+// the text ahead of it, ends on screen
+void lands(std::string_view line, std::string_view before, colour paint,
+           const char *what) {
+    std::vector<attrspan> spans;
+    lexer::lex(line, lexstate::code, &spans);
+    check(column_of(spans, paint) == render_width(before), what);
+    check(total(spans) == render_width(line), what);
+}
+
+} // namespace
+
+int main() {
+    // a stray continuation byte is one column, as it is drawn
+    lands("\x80 return 0;", "\x80 ", colour::keyword,
+          "continuation byte before a keyword");
+    // a sequence cut short is a column a byte
+    lands("\xe4\xb8 int x;", "\xe4\xb8 ", colour::type,
+          "truncated sequence before a type");
+    // a latin-1 byte that looks like the start of a longer character
+    lands("caf\xe9 \"str\"", "caf\xe9 ", colour::string,
+          "latin-1 byte before a string");
+    lands("\xe9\x80\"s\"", "\xe9\x80", colour::string,
+          "lead and continuation that don't make a character");
+    // well formed text still counts by width
+    lands("\"中\" 42", "\"中\" ", colour::number, "wide character");
+    lands("e\xcc\x81 // x", "e\xcc\x81 ", colour::comment, "combining mark");
+    return finish();
+}